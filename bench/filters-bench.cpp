@@ -0,0 +1,601 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Offscreen benchmark of the cost of the filter shaders. It creates a
+ * surfaceless EGL context, so it also runs on machines without a GPU or
+ * display, e.g. with Mesa's llvmpipe through LIBGL_ALWAYS_SOFTWARE=1.
+ * Every shader is specialized and fused as the plugin does it, with the
+ * shared glsl.cpp, then drawn by a copy of the plugin's draws in the
+ * shape of its two paths:
+ *
+ *  - views: each synthetic view is filtered into its own buffer, which is
+ *    then blended onto the output, like a view with cached results whose
+ *    contents change every frame.
+ *  - fullscreen: the whole output is filtered into a result buffer, which
+ *    is then copied onto the output, like a full redraw of the post hook.
+ *
+ * It does not run the plugin's render code, which needs a compositor, so
+ * batching, uniform uploads, damage scissoring and the buffer pool are not
+ * measured. Changes to those have to be checked in the compositor, e.g.
+ * with filters/stats.
+ *
+ * For each path it reports frames per second, the CPU time spent issuing
+ * each frame, and a hash of the final frame. With --output-dir, the final
+ * frames are also written there as PAM images, so that changes can be
+ * checked for pixel-exact output as well as for speed.
+ */
+
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <EGL/egl.h>
+#include <filesystem>
+#include <GLES3/gl3.h>
+#include <EGL/eglext.h>
+
+#include "glsl.hpp"
+
+using namespace wf::scene::filters;
+
+static const char *vertex_shader =
+    R"(
+#version 300 es
+
+in mediump vec2 position;
+in mediump vec2 texcoord;
+
+out mediump vec2 uvpos;
+
+uniform mat4 mvp;
+
+void main() {
+
+   gl_Position = mvp * vec4(position.xy, 0.0, 1.0);
+   uvpos = texcoord;
+}
+)";
+
+/* Stands in for what Wayfire substitutes for @builtin@ with RGBA textures */
+static const char *builtin_source =
+    R"(
+uniform sampler2D _wayfire_texture;
+mediump vec4 get_pixel(highp vec2 uv)
+{
+    return texture(_wayfire_texture, uv);
+}
+)";
+
+static const char *passthrough_fragment_shader =
+    R"(
+#version 300 es
+@builtin_ext@
+@builtin@
+
+precision mediump float;
+
+out vec4 out_color;
+in mediump vec2 uvpos;
+
+void main()
+{
+    out_color = get_pixel(uvpos);
+}
+)";
+
+struct bench_options_t
+{
+    int width  = 1920;
+    int height = 1080;
+    int view_width  = 800;
+    int view_height = 600;
+    int views  = 4;
+    int frames = 100;
+    std::string output_dir;
+    std::vector<std::string> shaders;
+};
+
+/* A texture with a framebuffer rendering into it */
+struct bench_target_t
+{
+    GLuint tex = 0;
+    GLuint fbo = 0;
+    int width  = 0;
+    int height = 0;
+};
+
+struct bench_path_result_t
+{
+    double fps = 0.0;
+    double cpu_ms = 0.0;
+    uint64_t hash = 0;
+};
+
+static bool parse_size(const char *arg, int& width, int& height)
+{
+    return (std::sscanf(arg, "%dx%d", &width, &height) == 2) && (width > 0) && (height > 0);
+}
+
+static bool parse_options(int argc, char **argv, bench_options_t& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value  = i + 1 < argc;
+        if ((arg == "--size") && has_value)
+        {
+            if (!parse_size(argv[++i], options.width, options.height))
+            {
+                return false;
+            }
+        } else if ((arg == "--view-size") && has_value)
+        {
+            if (!parse_size(argv[++i], options.view_width, options.view_height))
+            {
+                return false;
+            }
+        } else if ((arg == "--views") && has_value)
+        {
+            options.views = std::atoi(argv[++i]);
+        } else if ((arg == "--frames") && has_value)
+        {
+            options.frames = std::atoi(argv[++i]);
+        } else if ((arg == "--output-dir") && has_value)
+        {
+            options.output_dir = argv[++i];
+        } else if (arg.rfind("--", 0) == 0)
+        {
+            return false;
+        } else if (std::filesystem::is_directory(arg))
+        {
+            std::vector<std::string> files;
+            for (auto& entry : std::filesystem::directory_iterator(arg))
+            {
+                if (entry.is_regular_file())
+                {
+                    files.push_back(entry.path().string());
+                }
+            }
+
+            std::sort(files.begin(), files.end());
+            options.shaders.insert(options.shaders.end(), files.begin(), files.end());
+        } else
+        {
+            options.shaders.push_back(arg);
+        }
+    }
+
+    return !options.shaders.empty() && (options.views > 0) && (options.frames > 0);
+}
+
+static bool init_egl()
+{
+    auto get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!get_platform_display)
+    {
+        return false;
+    }
+
+    auto display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if ((display == EGL_NO_DISPLAY) || !eglInitialize(display, nullptr, nullptr) ||
+        !eglBindAPI(EGL_OPENGL_ES_API))
+    {
+        return false;
+    }
+
+    static const EGLint attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_NONE};
+    auto context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+    return (context != EGL_NO_CONTEXT) &&
+           eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+static std::string replace_all(std::string str, const std::string& from, const std::string& to)
+{
+    for (size_t pos = 0; (pos = str.find(from, pos)) != std::string::npos; pos += to.size())
+    {
+        str.replace(pos, from.size(), to);
+    }
+
+    return str;
+}
+
+static GLuint compile_shader(GLenum type, const std::string& source)
+{
+    auto shader = glCreateShader(type);
+    auto text   = source.c_str();
+    glShaderSource(shader, 1, &text, nullptr);
+    glCompileShader(shader);
+
+    GLint ok = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        char log[4096];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::fprintf(stderr, "%s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+/* Link @fragment as the plugin does, returns 0 on failure */
+static GLuint link_program(const std::string& fragment)
+{
+    auto source = replace_all(replace_all(fragment, "@builtin_ext@", ""), "@builtin@", builtin_source);
+    auto vs     = compile_shader(GL_VERTEX_SHADER, vertex_shader);
+    auto fs     = compile_shader(GL_FRAGMENT_SHADER, source);
+    if (!vs || !fs)
+    {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return 0;
+    }
+
+    auto program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint ok = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+/* A deterministic pattern of gradients and checkers, tinted by @seed */
+static std::vector<uint8_t> make_pattern(int width, int height, int seed)
+{
+    std::vector<uint8_t> pixels(size_t(width) * height * 4);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            auto pixel  = &pixels[(size_t(y) * width + x) * 4];
+            bool square = ((x / 32) + (y / 32)) % 2;
+            pixel[0] = (x * 255 / width + seed * 40) % 256;
+            pixel[1] = y * 255 / height;
+            pixel[2] = square ? 220 : 40;
+            pixel[3] = 255;
+        }
+    }
+
+    return pixels;
+}
+
+static bench_target_t create_target(int width, int height, const std::vector<uint8_t> *pixels)
+{
+    bench_target_t target;
+    target.width  = width;
+    target.height = height;
+    glGenTextures(1, &target.tex);
+    glBindTexture(GL_TEXTURE_2D, target.tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+        pixels ? pixels->data() : nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &target.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.tex, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return target;
+}
+
+static void destroy_target(bench_target_t& target)
+{
+    glDeleteFramebuffers(1, &target.fbo);
+    glDeleteTextures(1, &target.tex);
+    target = {};
+}
+
+/* Set the defaults of the shader's tunables, as the plugin does when applying it */
+static void set_tunables(GLuint program, const glsl_metadata_t& metadata)
+{
+    glUseProgram(program);
+    for (auto& tunable : metadata.tunables)
+    {
+        auto location = glGetUniformLocation(program, tunable.name.c_str());
+        auto& v = tunable.value;
+        if (tunable.type == "int")
+        {
+            glUniform1i(location, v[0]);
+        } else if (v.size() == 2)
+        {
+            glUniform2f(location, v[0], v[1]);
+        } else if (v.size() == 3)
+        {
+            glUniform3f(location, v[0], v[1], v[2]);
+        } else if (v.size() == 4)
+        {
+            glUniform4f(location, v[0], v[1], v[2], v[3]);
+        } else
+        {
+            glUniform1f(location, v[0]);
+        }
+    }
+}
+
+/*
+ * Draw @texture with @program into @box of @target. Drawing to the output
+ * blends, drawing to a buffer overwrites it. @flip turns the texture upside
+ * down, as the fullscreen path does when copying to the output.
+ */
+static void draw(GLuint program, GLuint texture, const bench_target_t& target,
+    int x, int y, int width, int height, bool blend, bool flip)
+{
+    static const float vertexData[] = {
+        -1.0f, -1.0f,
+        1.0f, -1.0f,
+        1.0f, 1.0f,
+        -1.0f, 1.0f
+    };
+    static const float flippedTexCoords[] = {
+        0.0f, 1.0f,
+        1.0f, 1.0f,
+        1.0f, 0.0f,
+        0.0f, 0.0f
+    };
+    static const float texCoords[] = {
+        0.0f, 0.0f,
+        1.0f, 0.0f,
+        1.0f, 1.0f,
+        0.0f, 1.0f
+    };
+    static const float identity[16] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+
+    glUseProgram(program);
+    GLint position = glGetAttribLocation(program, "position");
+    GLint texcoord = glGetAttribLocation(program, "texcoord");
+    glEnableVertexAttribArray(position);
+    glVertexAttribPointer(position, 2, GL_FLOAT, GL_FALSE, 0, vertexData);
+    glEnableVertexAttribArray(texcoord);
+    glVertexAttribPointer(texcoord, 2, GL_FLOAT, GL_FALSE, 0, flip ? flippedTexCoords : texCoords);
+    glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, GL_FALSE, identity);
+    glUniform1f(glGetUniformLocation(program, "progress"), 1.0);
+    glUniform1i(glGetUniformLocation(program, "in_tex"), 0);
+    /* What the plugin passes for a view without decorations */
+    glUniform4f(glGetUniformLocation(program, "margins"), 2.0, 2.0, 2.0, 2.0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(x, y, width, height);
+    if (blend)
+    {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    } else
+    {
+        glClearColor(0.0, 0.0, 0.0, 0.0);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    glDisable(GL_BLEND);
+    glDisableVertexAttribArray(position);
+    glDisableVertexAttribArray(texcoord);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* Read back @target, FNV-1a hash its pixels and write it to @path unless empty */
+static uint64_t save_target(const bench_target_t& target, const std::string& path)
+{
+    std::vector<uint8_t> pixels(size_t(target.width) * target.height * 4);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glReadPixels(0, 0, target.width, target.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    uint64_t hash = 14695981039346656037ull;
+    for (auto byte : pixels)
+    {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+
+    if (!path.empty())
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "P7\nWIDTH " << target.width << "\nHEIGHT " << target.height <<
+            "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+        size_t row = size_t(target.width) * 4;
+        for (int y = target.height - 1; y >= 0; y--)
+        {
+            file.write((const char*)&pixels[y * row], row);
+        }
+    }
+
+    return hash;
+}
+
+/* Run @frame @frames times, timing the CPU side of each frame and the whole run */
+template<class Frame>
+static bench_path_result_t run_frames(int frames, Frame frame)
+{
+    using clock = std::chrono::steady_clock;
+    std::chrono::duration<double, std::milli> cpu{0};
+
+    /* Warm up, the first frame may include driver work such as shader variants */
+    frame();
+    glFinish();
+
+    auto start = clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+        auto frame_start = clock::now();
+        frame();
+        cpu += clock::now() - frame_start;
+        glFinish();
+    }
+
+    std::chrono::duration<double> total = clock::now() - start;
+
+    bench_path_result_t result;
+    result.fps    = frames / total.count();
+    result.cpu_ms = cpu.count() / frames;
+    return result;
+}
+
+static std::string output_path(const bench_options_t& options, const std::string& shader,
+    const std::string& path_name)
+{
+    if (options.output_dir.empty())
+    {
+        return "";
+    }
+
+    auto name = std::filesystem::path(shader).filename().string();
+    return (std::filesystem::path(options.output_dir) / (name + "-" + path_name + ".pam")).string();
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t options;
+    if (!parse_options(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--size WxH] [--view-size WxH] [--views N] [--frames N] "
+                             "[--output-dir DIR] <shader or directory>...\n", argv[0]);
+        return 1;
+    }
+
+    /* Measure real compile times, not hits in Mesa's shader cache */
+    setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+    if (!init_egl())
+    {
+        std::fprintf(stderr, "Failed to create a surfaceless EGL context.\n");
+        return 1;
+    }
+
+    if (!options.output_dir.empty())
+    {
+        std::filesystem::create_directories(options.output_dir);
+    }
+
+    std::printf("Renderer: %s\n", glGetString(GL_RENDERER));
+    std::printf("Output %dx%d, %d views of %dx%d, %d frames\n\n", options.width, options.height,
+        options.views, options.view_width, options.view_height, options.frames);
+    std::printf("%-20s %10s %10s %10s %18s %10s %10s %18s\n", "shader", "link ms",
+        "views fps", "cpu ms", "views hash", "fs fps", "cpu ms", "fs hash");
+
+    auto passthrough = link_program(passthrough_fragment_shader);
+    auto background  = make_pattern(options.width, options.height, 0);
+    auto output = create_target(options.width, options.height, nullptr);
+    auto screen = create_target(options.width, options.height, &background);
+    auto result = create_target(options.width, options.height, nullptr);
+
+    std::vector<bench_target_t> views, caches;
+    auto view_pattern = make_pattern(options.view_width, options.view_height, 1);
+    for (int i = 0; i < options.views; i++)
+    {
+        views.push_back(create_target(options.view_width, options.view_height, &view_pattern));
+        caches.push_back(create_target(options.view_width, options.view_height, nullptr));
+    }
+
+    int failures = 0;
+    for (auto& shader : options.shaders)
+    {
+        std::ifstream file(shader);
+        std::stringstream source;
+        source << file.rdbuf();
+
+        /* Constants are compiled in at their defaults, as the plugin does */
+        auto metadata   = glsl_parse_metadata(source.str());
+        auto link_start = std::chrono::steady_clock::now();
+        auto program    = file ? link_program(glsl_specialize(source.str(), metadata.tunables)) : 0;
+        std::chrono::duration<double, std::milli> link_time = std::chrono::steady_clock::now() - link_start;
+        auto name = std::filesystem::path(shader).filename().string();
+        if (!program)
+        {
+            std::printf("%-20s failed to read or link\n", name.c_str());
+            failures++;
+            continue;
+        }
+
+        set_tunables(program, metadata);
+
+        /* Views cascade from a corner of the output */
+        auto views_result = run_frames(options.frames, [&] ()
+        {
+            draw(passthrough, screen.tex, output, 0, 0, output.width, output.height, false, false);
+            for (int i = 0; i < options.views; i++)
+            {
+                draw(program, views[i].tex, caches[i], 0, 0, caches[i].width, caches[i].height, false, false);
+                int x = (i * 64) % std::max(1, options.width - options.view_width);
+                int y = (i * 48) % std::max(1, options.height - options.view_height);
+                draw(passthrough, caches[i].tex, output, x, y, caches[i].width, caches[i].height, true, false);
+            }
+        });
+        views_result.hash = save_target(output, output_path(options, shader, "views"));
+
+        auto fs_result = run_frames(options.frames, [&] ()
+        {
+            draw(program, screen.tex, result, 0, 0, result.width, result.height, false, false);
+            draw(passthrough, result.tex, output, 0, 0, output.width, output.height, false, true);
+        });
+        fs_result.hash = save_target(output, output_path(options, shader, "fullscreen"));
+
+        std::printf("%-20s %10.2f %10.1f %10.3f %18llx %10.1f %10.3f %18llx\n", name.c_str(),
+            link_time.count(), views_result.fps, views_result.cpu_ms, (unsigned long long)views_result.hash,
+            fs_result.fps, fs_result.cpu_ms, (unsigned long long)fs_result.hash);
+        glDeleteProgram(program);
+    }
+
+    for (int i = 0; i < options.views; i++)
+    {
+        destroy_target(views[i]);
+        destroy_target(caches[i]);
+    }
+
+    destroy_target(output);
+    destroy_target(screen);
+    destroy_target(result);
+    glDeleteProgram(passthrough);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#!/usr/bin/python3
+
+import os
+import sys
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+# With --overwrite, an existing output file is replaced
+args = [arg for arg in sys.argv[1:] if arg != "--overwrite"]
+overwrite = len(args) != len(sys.argv) - 1
+
+if len(args) < 2:
+    print("Required arguments: [--overwrite] <output.cube> <shader or .cube> [<shader or .cube> ...]")
+    print("Only shaders depending on nothing but the color, such as monochrome or invert, can be baked")
+    exit(-1)
+
+sock = WayfireSocket()
+
+message = get_msg_template("wf/filters/bake-lut")
+message["data"]["path"] = os.path.abspath(args[0])
+message["data"]["shader-path"] = [os.path.abspath(arg) for arg in args[1:]]
+message["data"]["overwrite"] = overwrite
+print(sock.send_json(message))
@@ -0,0 +1,27 @@
+#!/usr/bin/python3
+
+# Print the estimated GPU memory used by filters.
+
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+sock = WayfireSocket()
+
+def mib(size):
+    return f'{size / (1 << 20):.1f} MiB'
+
+reply = sock.send_json(get_msg_template("wf/filters/memory"))
+if "error" in reply:
+    print(reply["error"])
+    exit(-1)
+
+memory = reply["memory"]
+budget = mib(memory["budget"]) if memory["budget"] else "none"
+print(f'Total {mib(memory["total"])}, budget {budget}')
+print(f'  programs and LUTs: {mib(memory["programs"])}')
+print(f'  pooled buffers: {mib(memory["pool"])}')
+for target in memory["views"] + memory["outputs"]:
+    name = f'View {target["view-id"]}' if "view-id" in target else f'Output {target["output-name"]}'
+    evicted = " (evicted)" if target["evicted"] else ""
+    print(f'  {name}: input {mib(target["input"])} cache {mib(target["cache"])}'
+          f' programs {mib(target["programs"])}{evicted}')
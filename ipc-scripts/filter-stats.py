@@ -0,0 +1,25 @@
+#!/usr/bin/python3
+
+# Print the per frame cost of every filter. Needs the filters/stats option.
+
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+sock = WayfireSocket()
+
+def summary(stats, key):
+    if not stats.get(key):
+        return "n/a"
+    return f'avg {stats[key]["avg"]:.3f} p99 {stats[key]["p99"]:.3f}'
+
+reply = sock.send_json(get_msg_template("wf/filters/stats"))
+if "error" in reply:
+    print(reply["error"])
+    exit(-1)
+
+for target in reply["views"] + reply["outputs"]:
+    name = f'View {target["view-id"]}' if "view-id" in target else f'Output {target["output-name"]}'
+    stats = target["stats"]
+    print(f'{name} {target["shader-path"]} over {stats["frames"]} frames:')
+    for key in ["cpu-ms", "gpu-ms", "pixels", "rects", "binds"]:
+        print(f'  {key}: {summary(stats, key)}')
@@ -1,45 +1,29 @@
 #!/usr/bin/python3
 
 # A simple script to apply a filter to untiled views.
+# The plugin applies it itself as views are tiled and untiled, through a
+# rule which is removed again when the script is interrupted.
 
 import os
 import sys
+import signal
 from wayfire import WayfireSocket
-from wayfire.extra.wpe import WPE
+from wayfire.core.template import get_msg_template
 
 if len(sys.argv) < 2:
     print("Required arguments: </path/to/shader>")
     exit(-1)
 
 sock = WayfireSocket()
-wpe = WPE(sock)
-sock.watch()
 
-def toggle_filter(view):
-    try:
-        if view["tiled-edges"] == 0:
-            if wpe.view_has_shader(int(view["id"]))["has-shader"] is False:
-                wpe.set_view_shader(int(view["id"]), os.path.abspath(str(sys.argv[1])))
-        else:
-            if wpe.view_has_shader(int(view["id"]))["has-shader"] is True:
-                wpe.unset_view_shader(int(view["id"]))
-    except:
-        pass
+def set_rules(rules):
+    message = get_msg_template("wf/filters/set-rules")
+    message["data"]["rules"] = rules
+    return sock.send_json(message)
 
-views = sock.list_views()
-for view in views:
-    toggle_filter(view)
+print(set_rules([{"tiled": False, "shader-path": os.path.abspath(str(sys.argv[1]))}]))
 
-while True:
-    try:
-        msg = sock.read_next_event()
-        if "event" in msg and "view" in msg and (msg["view"] is not None):
-            toggle_filter(msg["view"])
-    except KeyboardInterrupt:
-        views = sock.list_views()
-        for view in views:
-            try:
-                wpe.unset_view_shader(int(view["id"]))
-            except:
-                pass
-        exit(0)
+try:
+    signal.pause()
+except KeyboardInterrupt:
+    set_rules([])
@@ -0,0 +1,14 @@
+#!/usr/bin/python3
+
+import sys
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+sock = WayfireSocket()
+
+filters = sock.send_json(get_msg_template("wf/filters/list"))
+for view in filters["views"]:
+    rule = " (rule)" if view["from-rule"] else ""
+    print(f'View {view["view-id"]} {view["app-id"]}: {view["shader-path"]}{rule}')
+for output in filters["outputs"]:
+    print(f'Output {output["output-name"]}: {output["shader-path"]}')
@@ -0,0 +1,18 @@
+#!/usr/bin/python3
+
+import sys
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+if len(sys.argv) < 2:
+    print("Required arguments: <output name or all> [<scale>]")
+    print("Without a scale, the output follows the filters/fs_scale option again")
+    exit(-1)
+
+sock = WayfireSocket()
+
+message = get_msg_template("wf/filters/set-fs-scale")
+message["data"]["output-name"] = str(sys.argv[1])
+if len(sys.argv) > 2:
+    message["data"]["scale"] = float(sys.argv[2])
+print(sock.send_json(message))
@@ -6,10 +6,24 @@ from wayfire import WayfireSocket
 from wayfire.extra.wpe import WPE
 
 if len(sys.argv) < 3:
-    print("Required arguments: <Output name> </path/to/shader>")
+    print("Required arguments: <Output name> <pass> [<pass> ...]")
+    print("A pass is a /path/to/shader or blur[:radius[:iterations]]")
     exit(-1)
 
 sock = WayfireSocket()
 wpe = WPE(sock)
 
-wpe.set_fs_shader(str(sys.argv[1]), os.path.abspath(str(sys.argv[2])))
+def parse_pass(arg):
+    if arg != "blur" and not arg.startswith("blur:"):
+        return os.path.abspath(arg)
+    params = arg.split(":")[1:]
+    blur = {"builtin": "blur"}
+    if len(params) > 0:
+        blur["radius"] = float(params[0])
+    if len(params) > 1:
+        blur["iterations"] = int(params[1])
+    return blur
+
+# Multiple passes are applied in order
+shaders = [parse_pass(str(arg)) for arg in sys.argv[2:]]
+wpe.set_fs_shader(str(sys.argv[1]), shaders[0] if len(shaders) == 1 else shaders)
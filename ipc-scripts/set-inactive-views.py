@@ -1,48 +1,29 @@
 #!/usr/bin/python3
 
-# A simple script to apply a shader to all views except the active view
-# When a new view is focused, the shader is applied to the previously
-# active view. It skips app-id "panel", as this is wf-panel's app-id.
+# A simple script to apply a shader to all views except the active view.
+# The plugin applies it itself as focus changes, through a rule which is
+# removed again when the script is interrupted.
 
 import os
 import sys
+import signal
 from wayfire import WayfireSocket
-from wayfire.extra.wpe import WPE
+from wayfire.core.template import get_msg_template
 
 if len(sys.argv) == 1:
     print(f"Usage: {sys.argv[0]} /path/to/filters/shader")
     exit(-1)
 
 sock = WayfireSocket()
-wpe = WPE(sock)
-sock.watch(['view-focused'])
 
-def unset_view_shaders():
-    for view in sock.list_views():
-        wpe.unset_view_shader(view["id"])
+def set_rules(rules):
+    message = get_msg_template("wf/filters/set-rules")
+    message["data"]["rules"] = rules
+    return sock.send_json(message)
 
-active_view_id = sock.get_focused_view()["id"]
-active_view_app_id = sock.get_focused_view()["app-id"]
-for view in sock.list_views():
-    view_id = view["id"]
-    if view_id != active_view_id and view["app-id"] != "panel":
-        wpe.set_view_shader(view_id, os.path.abspath(str(sys.argv[1])))
-last_active_view_id = active_view_id
-last_active_view_app_id = active_view_app_id
+print(set_rules([{"focused": False, "shader-path": os.path.abspath(str(sys.argv[1]))}]))
 
-while True:
-    try:
-        msg = sock.read_next_event()
-        if "event" in msg:
-            active_view_id = sock.get_focused_view()["id"]
-            active_view_app_id = sock.get_focused_view()["app-id"]
-            if last_active_view_id != active_view_id and last_active_view_app_id != "panel":
-                wpe.set_view_shader(last_active_view_id, os.path.abspath(str(sys.argv[1])))
-                wpe.unset_view_shader(active_view_id)
-            last_active_view_id = active_view_id
-            last_active_view_app_id = active_view_app_id
-    except KeyboardInterrupt:
-        unset_view_shaders()
-        exit(0)
-    except:
-        pass
+try:
+    signal.pause()
+except KeyboardInterrupt:
+    set_rules([])
@@ -0,0 +1,21 @@
+#!/usr/bin/python3
+
+import sys
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+if len(sys.argv) < 2:
+    print("Required arguments: <View ID or output name> [<max fps>]")
+    print("Without a rate, the filter follows the max-fps its shaders declare again")
+    exit(-1)
+
+sock = WayfireSocket()
+
+message = get_msg_template("wf/filters/set-max-fps")
+if sys.argv[1].isdigit():
+    message["data"]["view-id"] = int(sys.argv[1])
+else:
+    message["data"]["output-name"] = str(sys.argv[1])
+if len(sys.argv) > 2:
+    message["data"]["max-fps"] = float(sys.argv[2])
+print(sock.send_json(message))
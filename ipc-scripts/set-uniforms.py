@@ -0,0 +1,26 @@
+#!/usr/bin/python3
+
+import sys
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+if len(sys.argv) < 3:
+    print("Required arguments: <View ID or output name> <name=value> [<name=value> ...]")
+    print("Vector values are comma separated, e.g. border_color=1.0,0.0,0.0,1.0")
+    exit(-1)
+
+sock = WayfireSocket()
+
+uniforms = {}
+for arg in sys.argv[2:]:
+    name, value = arg.split("=", 1)
+    components = [float(v) for v in value.split(",")]
+    uniforms[name] = components[0] if len(components) == 1 else components
+
+message = get_msg_template("wf/filters/set-uniforms")
+if sys.argv[1].isdigit():
+    message["data"]["view-id"] = int(sys.argv[1])
+else:
+    message["data"]["output-name"] = str(sys.argv[1])
+message["data"]["uniforms"] = uniforms
+print(sock.send_json(message))
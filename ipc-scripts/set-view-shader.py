@@ -4,12 +4,44 @@ import os
 import sys
 from wayfire import WayfireSocket
 from wayfire.extra.wpe import WPE
+from wayfire.core.template import get_msg_template
 
-if len(sys.argv) < 3:
-    print("Required arguments: <View ID> </path/to/shader>")
+# With --backdrop, the shader filters what is behind the view instead of the view
+args = [arg for arg in sys.argv[1:] if arg != "--backdrop"]
+backdrop = len(args) != len(sys.argv) - 1
+
+if len(args) < 2:
+    print("Required arguments: [--backdrop] <View ID> <pass> [<pass> ...]")
+    print("Several comma separated View IDs, or all, apply the shader to each of them")
+    print("A pass is a /path/to/shader or blur[:radius[:iterations]]")
     exit(-1)
 
 sock = WayfireSocket()
 wpe = WPE(sock)
 
-wpe.set_view_shader(int(sys.argv[1]), os.path.abspath(str(sys.argv[2])))
+def parse_pass(arg):
+    if arg != "blur" and not arg.startswith("blur:"):
+        return os.path.abspath(arg)
+    params = arg.split(":")[1:]
+    blur = {"builtin": "blur"}
+    if len(params) > 0:
+        blur["radius"] = float(params[0])
+    if len(params) > 1:
+        blur["iterations"] = int(params[1])
+    return blur
+
+# Multiple passes are applied in order
+shaders = [parse_pass(str(arg)) for arg in args[1:]]
+shader_path = shaders[0] if len(shaders) == 1 else shaders
+if args[0].isdigit() and not backdrop:
+    wpe.set_view_shader(int(args[0]), shader_path)
+else:
+    message = get_msg_template("wf/filters/set-view-shader")
+    if args[0].isdigit():
+        message["data"]["view-id"] = int(args[0])
+    else:
+        message["data"]["view-id"] = "all" if args[0] == "all" else [int(i) for i in args[0].split(",")]
+    message["data"]["shader-path"] = shader_path
+    if backdrop:
+        message["data"]["backdrop"] = True
+    print(sock.send_json(message))
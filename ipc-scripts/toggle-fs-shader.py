@@ -12,7 +12,9 @@ if len(sys.argv) < 2:
 sock = WayfireSocket()
 wpe = WPE(sock)
 
-has_shader = wpe.fs_has_shader(str(sys.argv[1]))["has-shader"]
+state = wpe.fs_has_shader(str(sys.argv[1]))
+# A shader which is fading out is as good as gone
+has_shader = state["has-shader"] and not state.get("fading-out", False)
 
 print(f'Fullscreen {sys.argv[1]} has shader: {has_shader}')
 
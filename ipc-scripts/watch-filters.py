@@ -0,0 +1,19 @@
+#!/usr/bin/python3
+
+# Print filter state changes as the plugin reports them.
+
+from wayfire import WayfireSocket
+from wayfire.core.template import get_msg_template
+
+sock = WayfireSocket()
+sock.send_json(get_msg_template("wf/filters/watch"))
+
+while True:
+    try:
+        msg = sock.read_next_event()
+        if "event" in msg:
+            target = msg.get("view-id", msg.get("output-name"))
+            error = f' ({msg["error"]})' if "error" in msg else ""
+            print(f'{msg["event"]} {target}: {msg["shader-path"]}{error}')
+    except KeyboardInterrupt:
+        exit(0)
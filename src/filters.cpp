@@ -22,8 +22,30 @@
  * SOFTWARE.
  */
 
+#include <map>
+#include <set>
+#include <list>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
 #include <fstream>
+#include <optional>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <EGL/egl.h>
+#include <algorithm>
+#include <filesystem>
+#include <GLES3/gl3.h>
+#include <EGL/eglext.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <condition_variable>
 #include <wayfire/core.hpp>
 #include <wayfire/view.hpp>
 #include <wayfire/plugin.hpp>
@@ -32,13 +54,19 @@
 #include <wayfire/util/duration.hpp>
 #include <wayfire/render-manager.hpp>
 #include <wayfire/view-transform.hpp>
+#include <wayfire/nonstd/wlroots-full.hpp>
 #include <wayfire/per-output-plugin.hpp>
 #include <wayfire/signal-definitions.hpp>
+#include <wayfire/config/compound-option.hpp>
 #include <wayfire/plugins/ipc/ipc-helpers.hpp>
 #include <wayfire/plugins/ipc/ipc-activator.hpp>
 #include <wayfire/plugins/common/shared-core-data.hpp>
 #include <wayfire/plugins/ipc/ipc-method-repository.hpp>
 
+#include "lut.hpp"
+#include "glsl.hpp"
+#include "stats.hpp"
+
 
 static const char *vertex_shader =
     R"(
@@ -76,6 +104,142 @@ void main() {
 // }
 // )";
 
+/* Used to draw cached filter results */
+static const char *passthrough_fragment_shader =
+    R"(
+#version 300 es
+@builtin_ext@
+@builtin@
+
+precision mediump float;
+
+out vec4 out_color;
+in mediump vec2 uvpos;
+
+void main()
+{
+    out_color = get_pixel(uvpos);
+}
+)";
+
+/*
+ * Built-in dual Kawase blur. Every pass takes a handful of bilinear taps
+ * around the pixel, at an offset of @offset half pixels of the level it
+ * renders to.
+ */
+static const char *blur_down_fragment_shader =
+    R"(
+#version 300 es
+@builtin_ext@
+@builtin@
+
+precision mediump float;
+
+uniform vec2 halfpixel;
+uniform float offset;
+out vec4 out_color;
+in mediump vec2 uvpos;
+
+void main()
+{
+    vec2 o = halfpixel * offset;
+    vec4 sum = get_pixel(uvpos) * 4.0;
+    sum += get_pixel(uvpos - o);
+    sum += get_pixel(uvpos + o);
+    sum += get_pixel(uvpos + vec2(o.x, -o.y));
+    sum += get_pixel(uvpos - vec2(o.x, -o.y));
+    out_color = sum / 8.0;
+}
+)";
+
+static const char *blur_up_fragment_shader =
+    R"(
+#version 300 es
+@builtin_ext@
+@builtin@
+
+precision mediump float;
+
+uniform vec2 halfpixel;
+uniform float offset;
+out vec4 out_color;
+in mediump vec2 uvpos;
+
+void main()
+{
+    vec2 o = halfpixel * offset;
+    vec4 sum = get_pixel(uvpos + vec2(-o.x * 2.0, 0.0));
+    sum += get_pixel(uvpos + vec2(-o.x, o.y)) * 2.0;
+    sum += get_pixel(uvpos + vec2(0.0, o.y * 2.0));
+    sum += get_pixel(uvpos + vec2(o.x, o.y)) * 2.0;
+    sum += get_pixel(uvpos + vec2(o.x * 2.0, 0.0));
+    sum += get_pixel(uvpos + vec2(o.x, -o.y)) * 2.0;
+    sum += get_pixel(uvpos + vec2(0.0, -o.y * 2.0));
+    sum += get_pixel(uvpos + vec2(-o.x, -o.y)) * 2.0;
+    out_color = sum / 12.0;
+}
+)";
+
+/* The last upsample, fading between the unblurred input and the blur */
+static const char *blur_final_fragment_shader =
+    R"(
+#version 300 es
+@builtin_ext@
+@builtin@
+
+precision mediump float;
+
+uniform sampler2D original;
+uniform vec2 halfpixel;
+uniform float offset;
+uniform float progress;
+out vec4 out_color;
+in mediump vec2 uvpos;
+
+void main()
+{
+    vec2 o = halfpixel * offset;
+    vec4 sum = get_pixel(uvpos + vec2(-o.x * 2.0, 0.0));
+    sum += get_pixel(uvpos + vec2(-o.x, o.y)) * 2.0;
+    sum += get_pixel(uvpos + vec2(0.0, o.y * 2.0));
+    sum += get_pixel(uvpos + vec2(o.x, o.y)) * 2.0;
+    sum += get_pixel(uvpos + vec2(o.x * 2.0, 0.0));
+    sum += get_pixel(uvpos + vec2(o.x, -o.y)) * 2.0;
+    sum += get_pixel(uvpos + vec2(0.0, -o.y * 2.0));
+    sum += get_pixel(uvpos + vec2(-o.x, -o.y)) * 2.0;
+    out_color = mix(texture(original, uvpos), sum / 12.0, progress);
+}
+)";
+
+/*
+ * Built-in 3D LUT pass. The table maps straight colors, so the input is
+ * unpremultiplied before the lookup. @lut_scale and @lut_offset map the
+ * table's domain onto the centers of its first and last texels.
+ */
+static const char *lut_fragment_shader =
+    R"(
+#version 300 es
+@builtin_ext@
+@builtin@
+
+precision mediump float;
+
+uniform mediump sampler3D lut;
+uniform vec3 lut_scale;
+uniform vec3 lut_offset;
+uniform float progress;
+out vec4 out_color;
+in mediump vec2 uvpos;
+
+void main()
+{
+    vec4 c = get_pixel(uvpos);
+    vec3 rgb = c.a > 0.0 ? c.rgb / c.a : c.rgb;
+    vec3 mapped = texture(lut, rgb * lut_scale + lut_offset).rgb;
+    out_color = mix(c, vec4(mapped * c.a, c.a), progress);
+}
+)";
+
 static std::string pixdecor_custom_data_name = "wf-decoration-shadow-margin";
 
 class wf_shadow_margin_t : public wf::custom_data_t
@@ -103,564 +267,5666 @@ namespace filters
 {
 const std::string transformer_name = "filters";
 
-class wf_filters : public wf::scene::view_2d_transformer_t
+/* Parameters of the built-in blur */
+struct blur_params_t
 {
-    wayfire_view view;
-    wf::output_t *output;
-    OpenGL::program_t *shader;
-    std::unique_ptr<wf::animation::simple_animation_t> fade;
+    /* Tap offset, in half pixels of each downsampled level */
+    float radius   = 2.0;
+    /* Number of times the input is halved in size */
+    int iterations = 3;
+};
 
-  public:
-    OpenGL::program_t program;
-    class simple_node_render_instance_t : public wf::scene::transformer_render_instance_t<transformer_base_node_t>
+/*
+ * A requested pass: a shader file, a .cube LUT file, or the built-in blur
+ * if blur is set
+ */
+struct filter_pass_t
+{
+    std::string path;
+    std::string source;
+    std::optional<blur_params_t> blur;
+};
+
+/* A pass as given over IPC, see wayfire_filters::get_filter_pass() */
+static wf::json_t pass_to_json(const filter_pass_t& pass)
+{
+    if (!pass.blur)
     {
-        wf::signal::connection_t<node_damage_signal> on_node_damaged =
-            [=] (node_damage_signal *ev)
-        {
-            push_to_parent(ev->region);
-        };
+        return pass.path;
+    }
 
-        wf_filters *self;
-        wayfire_view view;
-        damage_callback push_to_parent;
+    wf::json_t item;
+    item["builtin"]    = "blur";
+    item["radius"]     = pass.blur->radius;
+    item["iterations"] = pass.blur->iterations;
+    return item;
+}
 
-      public:
-        simple_node_render_instance_t(wf_filters *self, damage_callback push_damage,
-            wayfire_view view) : wf::scene::transformer_render_instance_t<transformer_base_node_t>(self,
-                push_damage,
-                view->get_output())
-        {
-            this->self = self;
-            this->view = view;
-            this->push_to_parent = push_damage;
-            self->connect(&on_node_damaged);
-        }
+static wf::json_t pass_list_to_json(const std::vector<filter_pass_t>& passes)
+{
+    auto list = wf::json_t::array();
+    for (auto& pass : passes)
+    {
+        list.append(pass_to_json(pass));
+    }
 
-        ~simple_node_render_instance_t()
-        {}
+    return list;
+}
 
-        void schedule_instructions(
-            std::vector<render_instruction_t>& instructions,
-            const wf::render_target_t& target, wf::regionf_t& damage)
-        {
-            // We want to render ourselves only, the node does not have children
-            instructions.push_back(render_instruction_t{
-                            .instance = this,
-                            .target   = target,
-                            .damage   = damage & self->get_bounding_box(),
-                        });
-        }
+static bool is_lut_pass(const filter_pass_t& pass)
+{
+    auto suffix = std::string(".cube");
+    return !pass.blur && (pass.path.size() > suffix.size()) &&
+           (pass.path.compare(pass.path.size() - suffix.size(), suffix.size(), suffix) == 0);
+}
 
-        void render(const wf::scene::render_instruction_t& data)
+/* Read the source of every shader pass, returns false if any file cannot be read. */
+static bool load_shader_sources(std::vector<filter_pass_t>& passes)
+{
+    bool ok = true;
+    for (auto& pass : passes)
+    {
+        if (pass.blur)
         {
-            wlr_box fb_geom =
-                data.target.framebuffer_box_from_geometry_box(data.target.geometry);
-            auto view_box = data.target.framebuffer_box_from_geometry_box(
-                self->get_children_bounding_box());
-            view_box.x -= fb_geom.x;
-            view_box.y -= fb_geom.y;
-
-            float x = view_box.x, y = view_box.y, w = view_box.width,
-                h = view_box.height;
+            continue;
+        }
 
-            static const float vertexData[] = {
-                -1.0f, -1.0f,
-                1.0f, -1.0f,
-                1.0f, 1.0f,
-                -1.0f, 1.0f
-            };
-            static const float texCoords[] = {
-                0.0f, 0.0f,
-                1.0f, 0.0f,
-                1.0f, 1.0f,
-                0.0f, 1.0f
-            };
+        std::ifstream t(pass.path);
+        ok &= t.good();
+        pass.source = std::string((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+    }
 
-            auto src_tex = wf::gles_texture_t{get_texture(1.0)};
-            data.pass->custom_gles_subpass(data.target, [&]
-            {
-                this->self->shader->use(src_tex.type);
-                this->self->shader->attrib_pointer("position", 2, 0, vertexData);
-                this->self->shader->attrib_pointer("texcoord", 2, 0, texCoords);
-                this->self->shader->uniformMatrix4f("mvp", wf::gles::output_transform(data.target));
-                this->self->shader->uniform1f("progress", *self->fade);
-                this->self->shader->uniform1i("in_tex", 0);
-
-                if (auto toplevel = wf::toplevel_cast(this->view))
-                {
-                    auto bg = view->get_surface_root_node()->get_bounding_box();
-                    auto vg = toplevel->get_geometry();
-                    auto margins =
-                        glm::vec4{vg.x - bg.x, vg.y - bg.y, bg.width - ((vg.x - bg.x) + vg.width),
-                        bg.height - ((vg.y - bg.y) + vg.height)};
-                    if (view->has_data(pixdecor_custom_data_name))
-                    {
-                        auto decoration_margins =
-                            view->get_data<wf_shadow_margin_t>(pixdecor_custom_data_name)->get_margins();
-                        margins.x += decoration_margins.left;
-                        margins.y += decoration_margins.bottom;
-                        margins.z += decoration_margins.right;
-                        margins.w += decoration_margins.top;
-                    }
+    return ok;
+}
 
-                    // XXX: Pad the margins if there are none, so that the shader renders on the surface
-                    if (bg == vg)
-                    {
-                        margins.x += 2.0;
-                        margins.y += 2.0;
-                        margins.z += 2.0;
-                        margins.w += 2.0;
-                    }
+/* 64-bit FNV-1a, stable across runs so it can name on-disk cache entries */
+static uint64_t hash_string(const std::string& str, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    for (unsigned char c : str)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
 
-                    this->self->shader->uniform4f("margins", margins);
-                }
+    return hash;
+}
 
-                GL_CALL(glActiveTexture(GL_TEXTURE0));
-                this->self->shader->set_active_texture(src_tex);
+static std::string hash_to_hex(uint64_t hash)
+{
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)hash);
+    return buf;
+}
 
-                /* Render it to target */
-                wf::gles::bind_render_buffer(data.target);
-                GL_CALL(glViewport(x, y, w, h));
+/*
+ * Stores linked program binaries under $XDG_CACHE_HOME/wayfire/filters so
+ * that later runs can skip compilation entirely. Entries are keyed by the
+ * shader sources, the GL driver vendor, renderer and version strings and
+ * the texture type variant. The full key is also stored inside the file,
+ * so a hash collision or a driver update only causes a miss.
+ */
+class program_binary_cache_t
+{
+    static constexpr uint32_t magic   = 0x42465746; // "FWFB"
+    static constexpr uint32_t version = 1;
 
-                GL_CALL(glEnable(GL_BLEND));
-                GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+    struct header_t
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t key_length;
+        uint32_t binary_length;
+    };
 
-                for (const auto& box : data.damage)
-                {
-                    wf::gles::render_target_logic_scissor(data.target, box);
-                    GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
-                }
+    std::mutex mutex;
+    std::string driver;
+    bool supported = false;
+    bool initialized = false;
 
-                /* Disable stuff */
-                GL_CALL(glDisable(GL_BLEND));
-                GL_CALL(glActiveTexture(GL_TEXTURE0));
-                GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
-                GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    void init()
+    {
+        if (initialized)
+        {
+            return;
+        }
 
-                this->self->shader->deactivate();
-            });
+        initialized = true;
+        GLint formats = 0;
+        GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+        supported = formats > 0;
+        for (auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        {
+            auto str = (const char*)glGetString(name);
+            driver += std::string(str ? str : "") + "\n";
         }
-    };
+    }
 
-    wf_filters(wayfire_view view, std::string shader_path) : wf::scene::view_2d_transformer_t(view)
+    static std::filesystem::path cache_dir()
     {
-        this->view   = view;
-        this->shader = &program;
-        if (view->get_output())
+        const char *xdg_cache = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        std::filesystem::path dir;
+        if (xdg_cache && *xdg_cache)
         {
-            output = view->get_output();
-            output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+            dir = xdg_cache;
+        } else if (home && *home)
+        {
+            dir = std::filesystem::path(home) / ".cache";
+        } else
+        {
+            return {};
         }
 
-        std::ifstream t(shader_path);
-        std::string fragment_shader((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-        wf::gles::run_in_context([&]
-        {
-            program.compile(vertex_shader, fragment_shader);
-        });
-        fade = std::make_unique<wf::animation::simple_animation_t>(wf::create_option<int>(700));
-        fade->set(0.0, 0.0);
-        fade->animate(1.0);
+        return dir / "wayfire" / "filters";
     }
 
-    void unapply()
+    std::string make_key(const std::string& source, wf::texture_type_t type)
     {
-        fade->animate(0.0);
+        return driver + std::to_string(type) + "\n" + vertex_shader + source;
     }
 
-    void pop_transformer(wayfire_view view)
+  public:
+    /* Must be called with the GL context current. Returns 0 on a miss. */
+    GLuint load(const std::string& source, wf::texture_type_t type)
     {
-        if (view->get_transformed_node()->get_transformer(transformer_name))
+        std::lock_guard<std::mutex> lock(mutex);
+        init();
+        auto dir = cache_dir();
+        if (!supported || dir.empty())
         {
-            LOGI("Removing shader and transformer.");
-            view->get_transformed_node()->rem_transformer(transformer_name);
+            return 0;
+        }
+
+        auto key  = make_key(source, type);
+        auto path = dir / hash_to_hex(hash_string(key));
+        std::ifstream file(path, std::ios::binary);
+        header_t header;
+        if (!file.read((char*)&header, sizeof(header)) ||
+            (header.magic != magic) || (header.version != version) ||
+            (header.key_length != key.size()))
+        {
+            return 0;
+        }
+
+        std::string stored_key(header.key_length, '\0');
+        std::vector<char> binary(header.binary_length);
+        if (!file.read(stored_key.data(), stored_key.size()) || (stored_key != key) ||
+            !file.read(binary.data(), binary.size()))
+        {
+            return 0;
+        }
+
+        GLuint id = glCreateProgram();
+        GL_CALL(glProgramBinary(id, header.format, binary.data(), binary.size()));
+        GLint status = GL_FALSE;
+        GL_CALL(glGetProgramiv(id, GL_LINK_STATUS, &status));
+        if (status != GL_TRUE)
+        {
+            /* Rejected by the driver, drop the stale entry and recompile */
+            GL_CALL(glDeleteProgram(id));
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            return 0;
         }
+
+        return id;
     }
 
-    wf::effect_hook_t pre_hook = [=] ()
+    /* Must be called with the GL context current. */
+    void store(const std::string& source, wf::texture_type_t type, GLuint id)
     {
-        if (fade->running())
+        std::lock_guard<std::mutex> lock(mutex);
+        init();
+        auto dir = cache_dir();
+        if (!supported || dir.empty() || !id)
         {
-            for (auto & v : wf::get_core().get_all_views())
+            return;
+        }
+
+        GLint length = 0;
+        GL_CALL(glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length));
+        if (length <= 0)
+        {
+            return;
+        }
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        GL_CALL(glGetProgramBinary(id, length, &length, &format, binary.data()));
+
+        auto key = make_key(source, type);
+        header_t header = {magic, version, format, (uint32_t)key.size(), (uint32_t)length};
+
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        auto path = dir / hash_to_hex(hash_string(key));
+        auto tmp  = path;
+        tmp += ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            file.write((char*)&header, sizeof(header));
+            file.write(key.data(), key.size());
+            file.write(binary.data(), length);
+            if (!file)
             {
-                v->damage();
+                LOGE("Failed to write shader binary cache entry ", tmp.string());
+                return;
             }
-        } else if (fade->end == 0.0)
-        {
-            pop_transformer(view);
         }
-    };
 
-    void gen_render_instances(std::vector<render_instance_uptr>& instances,
-        damage_callback push_damage, wf::output_t *shown_on) override
+        std::filesystem::rename(tmp, path, ec);
+    }
+};
+
+enum program_cache_result_t
+{
+    /* Program was already linked for another view or output */
+    PROGRAM_CACHE_SHARED,
+    /* Program binary was loaded from the on-disk cache */
+    PROGRAM_CACHE_DISK_HIT,
+    /* Program had to be compiled */
+    PROGRAM_CACHE_MISS,
+};
+
+static const char *program_cache_result_to_string(program_cache_result_t result)
+{
+    switch (result)
     {
-        instances.push_back(std::make_unique<simple_node_render_instance_t>(
-            this, push_damage, view));
+      case PROGRAM_CACHE_SHARED:
+        return "shared";
+
+      case PROGRAM_CACHE_DISK_HIT:
+        return "hit";
+
+      case PROGRAM_CACHE_MISS:
+        return "miss";
     }
 
-    virtual ~wf_filters()
+    return "unknown";
+}
+
+/* An active uniform of a linked program */
+struct active_uniform_t
+{
+    GLenum type;
+    GLint location;
+    /* The value last uploaded, empty until the first upload */
+    std::vector<float> value;
+};
+
+/*
+ * A linked filter program. Instances are shared between every view and
+ * output using the same shader source, see program_cache_t.
+ */
+struct filter_program_t
+{
+    OpenGL::program_t program;
+    std::string source;
+    uint64_t hash;
+    /* The variant the program is used as, always RGBA, see program_cache_t */
+    wf::texture_type_t type;
+    /* Whether the output only depends on the input texture and uniforms */
+    bool cacheable;
+    /* Every active uniform by name, filled in when linking */
+    std::map<std::string, active_uniform_t> active_uniforms;
+    GLint position_location = -1;
+    GLint texcoord_location = -1;
+    /* The quad drawn by every pass, created on first use by bind_quad() */
+    GLuint quad_vbo = 0;
+    GLuint quad_vaos[2] = {0, 0};
+    /* The driver's binary size of the linked program, as an estimate of its GPU memory */
+    size_t bytes = 0;
+};
+
+/* A color LUT, uploaded as a 3D texture on its first use, see bind_lut() */
+struct lut_texture_t
+{
+    lut_t lut;
+    GLuint tex = 0;
+
+    size_t get_bytes() const
     {
-        wf::gles::run_in_context([&]
-        {
-            program.free_resources();
-        });
-        fade.reset();
-        if (output)
-        {
-            output->render->rem_effect(&pre_hook);
-        }
+        /* RGB16F */
+        return tex ? (size_t)lut.size * lut.size * lut.size * 6 : 0;
     }
 };
 
-class wayfire_per_output_filters : public wf::per_output_plugin_instance_t
+/*
+ * Plugin-wide cache of parsed LUTs, keyed by the contents of their files.
+ * Like program_cache_t it only holds weak references. It is also used by
+ * the shader loader thread, so it is locked.
+ */
+class lut_cache_t
 {
-    std::unique_ptr<wf::animation::simple_animation_t> fade;
-    std::shared_ptr<OpenGL::program_t> program = nullptr;
-    wf::post_hook_t hook;
-    bool active = false;
+    std::mutex mutex;
+    std::map<uint64_t, std::weak_ptr<lut_texture_t>> luts;
 
   public:
-    void init() override
+    /* GPU memory of the tables uploaded so far */
+    size_t get_bytes()
     {
-        hook = [=] (wf::auxilliary_buffer_t& aux_buf, const wf::render_buffer_t& render_buf)
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t bytes = 0;
+        for (auto& [hash, weak] : luts)
         {
-            render(aux_buf, render_buf);
-        };
-        fade = std::make_unique<wf::animation::simple_animation_t>(wf::create_option<int>(700));
-        fade->set(0.0, 0.0);
+            if (auto lut = weak.lock())
+            {
+                bytes += lut->get_bytes();
+            }
+        }
+
+        return bytes;
     }
 
-    wf::effect_hook_t pre_hook = [=] ()
+    /*
+     * The table applying all of @passes in order, composed into one.
+     * Returns nullptr if any of them cannot be parsed.
+     */
+    std::shared_ptr<lut_texture_t> acquire(const std::vector<const filter_pass_t*>& passes)
     {
-        if (fade->running())
+        uint64_t hash = hash_string("lut");
+        for (auto pass : passes)
+        {
+            hash = hash_string(pass->source, hash);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = luts.begin(); it != luts.end();)
+        {
+            it = it->second.expired() ? luts.erase(it) : std::next(it);
+        }
+
+        auto it = luts.find(hash);
+        if (it != luts.end())
         {
-            output->render->damage_whole();
-            for (auto & v : wf::get_core().get_all_views())
+            return it->second.lock();
+        }
+
+        std::optional<lut_t> combined;
+        for (auto pass : passes)
+        {
+            std::string error;
+            auto lut = lut_parse_cube(pass->source, error);
+            if (!lut)
             {
-                v->damage();
+                LOGE("Failed to parse LUT ", pass->path, ": ", error);
+                return nullptr;
             }
-        } else if (fade->end == 0.0)
+
+            combined = combined ? lut_compose(*combined, *lut) : *lut;
+        }
+
+        auto texture = std::shared_ptr<lut_texture_t>(new lut_texture_t{*combined, 0},
+            [] (lut_texture_t *texture)
         {
-            output->render->rem_effect(&pre_hook);
-            output->render->rem_post(&hook);
-            output->render->damage_whole();
-            if (program)
+            if (texture->tex)
             {
                 wf::gles::run_in_context([&]
                 {
-                    program->free_resources();
+                    GL_CALL(glDeleteTextures(1, &texture->tex));
                 });
             }
 
-            program = nullptr;
-            active  = false;
-        }
-    };
-
-    wf::json_t set_fs_shader(std::string shader)
-    {
-        if (program)
+            delete texture;
+        });
+        luts[hash] = texture;
+        return texture;
+    }
+};
+
+/* A value for a float, vec2, vec3, vec4, int or bool uniform */
+struct uniform_value_t
+{
+    GLenum type;
+    std::vector<float> value;
+};
+
+/*
+ * One step of a filter chain. Shader stages run a single program, blur
+ * stages run the down, up and final blur programs.
+ */
+struct filter_stage_t
+{
+    std::vector<std::shared_ptr<filter_program_t>> programs;
+    /* The source before specialization, empty if it has no constants */
+    std::string base_source;
+    std::optional<blur_params_t> blur;
+    /* Consecutive LUT passes, composed into one table */
+    std::shared_ptr<lut_texture_t> lut;
+    /* Combined from the metadata of the stage's passes, see glsl_parse_metadata() */
+    float sampling_radius = -1.0;
+    std::vector<std::string> radius_uniforms;
+    bool time_dependent = false;
+    /* Set if the output only depends on the input color, see glsl_metadata_t */
+    bool color_only     = false;
+    /* The lowest max-fps of the passes, 0 if none declares one */
+    float max_fps = 0.0;
+    bool needs_margins  = false;
+    /*
+     * Set if every pass only changes pixels near the edges. The bands are
+     * measured from the window geometry and from the texture edges, see
+     * glsl_metadata_t::edge_band.
+     */
+    bool edge_only = false;
+    std::vector<std::string> window_band, texture_band;
+    std::vector<glsl_tunable_t> tunables;
+    /* Uploaded before every draw, tunable defaults unless set over IPC */
+    std::map<std::string, uniform_value_t> uniforms;
+
+    /* How far the stage reads around each pixel, negative if unknown */
+    float get_sampling_radius() const
+    {
+        float radius = sampling_radius;
+        for (auto& name : radius_uniforms)
+        {
+            auto it = uniforms.find(name);
+            if ((radius >= 0.0) && (it != uniforms.end()))
+            {
+                radius += std::abs(it->second.value[0]);
+            }
+        }
+
+        return radius;
+    }
+
+    /* The constants of the stage at their current values, see glsl_specialize() */
+    std::vector<glsl_tunable_t> get_constants() const
+    {
+        std::vector<glsl_tunable_t> constants;
+        for (auto tunable : tunables)
+        {
+            if (tunable.constant)
+            {
+                tunable.value = uniforms.at(tunable.name).value;
+                constants.push_back(tunable);
+            }
+        }
+
+        return constants;
+    }
+
+    /* The width of an edge band, following the current values of its tunables */
+    float get_band_width(const std::vector<std::string>& terms) const
+    {
+        float width = 0.0;
+        for (auto& term : terms)
+        {
+            auto it = uniforms.find(term);
+            width = std::max(width, (it != uniforms.end()) ?
+                std::abs(it->second.value[0]) : std::strtof(term.c_str(), nullptr));
+        }
+
+        return width;
+    }
+};
+
+/*
+ * The stages a view or output filter runs, in order. Pointwise passes are
+ * fused into the pass before them, so there may be fewer stages than
+ * requested passes.
+ */
+struct filter_chain_t
+{
+    std::vector<filter_stage_t> stages;
+    /* The passes the chain was built from, without their sources */
+    std::vector<filter_pass_t> passes;
+    /* Set over IPC, overrides the max-fps declared by the shaders */
+    std::optional<float> max_fps_override;
+    /* Filter what is behind the view instead of the view, see wf_filters */
+    bool backdrop = false;
+
+    void set_passes(const std::vector<filter_pass_t>& requested)
+    {
+        passes = requested;
+        for (auto& pass : passes)
+        {
+            pass.source.clear();
+        }
+    }
+
+    bool cacheable() const
+    {
+        for (auto& stage : stages)
+        {
+            if (stage.time_dependent)
+            {
+                return false;
+            }
+
+            for (auto& program : stage.programs)
+            {
+                if (!program->cacheable)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /* How far the output of the whole chain reads from its input, negative if unknown */
+    float sampling_radius() const
+    {
+        float radius = 0.0;
+        for (auto& stage : stages)
+        {
+            float stage_radius = stage.get_sampling_radius();
+            if (stage_radius < 0.0)
+            {
+                return -1.0;
+            }
+
+            radius += stage_radius;
+        }
+
+        return radius;
+    }
+
+    bool time_dependent() const
+    {
+        return std::any_of(stages.begin(), stages.end(),
+            [] (const filter_stage_t& stage) { return stage.time_dependent; });
+    }
+
+    bool needs_margins() const
+    {
+        return std::any_of(stages.begin(), stages.end(),
+            [] (const filter_stage_t& stage) { return stage.needs_margins; });
+    }
+
+    /* Whether the chain maps each color to another one, regardless of where it is */
+    bool color_only() const
+    {
+        return std::all_of(stages.begin(), stages.end(),
+            [] (const filter_stage_t& stage) { return stage.color_only; });
+    }
+
+    /* Estimated GPU memory of the programs and LUTs of the chain, which may be shared */
+    size_t get_program_bytes() const
+    {
+        size_t bytes = 0;
+        for (auto& stage : stages)
+        {
+            for (auto& program : stage.programs)
+            {
+                bytes += program->bytes;
+            }
+
+            bytes += stage.lut ? stage.lut->get_bytes() : 0;
+        }
+
+        return bytes;
+    }
+
+    /* How often a time dependent chain is redrawn at most, 0 if not limited */
+    float max_fps() const
+    {
+        if (max_fps_override)
+        {
+            return *max_fps_override;
+        }
+
+        float fps = 0.0;
+        for (auto& stage : stages)
+        {
+            if ((stage.max_fps > 0.0) && ((fps == 0.0) || (stage.max_fps < fps)))
+            {
+                fps = stage.max_fps;
+            }
+        }
+
+        return fps;
+    }
+};
+
+/* GPU memory of an RGBA8 buffer of @size */
+static size_t buffer_bytes(wf::dimensions_t size)
+{
+    return (size_t)std::max(0, size.width) * std::max(0, size.height) * 4;
+}
+
+/*
+ * Plugin-wide pool of intermediate buffers for multi-pass filters. Buffers
+ * are handed out by size and returned after the pass reading them is done,
+ * so consecutive passes ping-pong between two buffers and the same buffers
+ * are reused across frames, views and outputs.
+ */
+class buffer_pool_t
+{
+    /* Most recently released last */
+    std::vector<std::unique_ptr<wf::auxilliary_buffer_t>> free_buffers;
+    static constexpr size_t max_free_buffers = 16;
+
+  public:
+    std::unique_ptr<wf::auxilliary_buffer_t> acquire(wf::dimensions_t size)
+    {
+        for (auto it = free_buffers.rbegin(); it != free_buffers.rend(); ++it)
+        {
+            if ((*it)->get_size() == size)
+            {
+                auto buffer = std::move(*it);
+                free_buffers.erase(std::next(it).base());
+                return buffer;
+            }
+        }
+
+        auto buffer = std::make_unique<wf::auxilliary_buffer_t>();
+        buffer->allocate(size, 1.0);
+        return buffer;
+    }
+
+    void release(std::unique_ptr<wf::auxilliary_buffer_t> buffer)
+    {
+        if (!buffer)
+        {
+            return;
+        }
+
+        free_buffers.push_back(std::move(buffer));
+        if (free_buffers.size() > max_free_buffers)
+        {
+            free_buffers.erase(free_buffers.begin());
+        }
+    }
+
+    /* GPU memory held by the free buffers */
+    size_t get_free_bytes()
+    {
+        size_t bytes = 0;
+        for (auto& buffer : free_buffers)
+        {
+            bytes += buffer_bytes(buffer->get_size());
+        }
+
+        return bytes;
+    }
+
+    /* Free all buffers not in use, see memory_tracker_t */
+    void clear()
+    {
+        free_buffers.clear();
+    }
+};
+
+/* Sets the uniforms specific to one draw, called with the input texture bound */
+using uniform_setter_t = std::function<void (filter_program_t*)>;
+
+/* Sample the bound texture bilinearly, without wrapping around at the edges */
+static void use_bilinear_sampling(filter_program_t*)
+{
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+}
+
+/* Number of components of the uniform types that can be set, 0 for others */
+static size_t uniform_components(GLenum type)
+{
+    switch (type)
+    {
+      case GL_FLOAT:
+      case GL_INT:
+      case GL_BOOL:
+        return 1;
+
+      case GL_FLOAT_VEC2:
+        return 2;
+
+      case GL_FLOAT_VEC3:
+        return 3;
+
+      case GL_FLOAT_VEC4:
+        return 4;
+
+      default:
+        return 0;
+    }
+}
+
+static GLenum tunable_type(const glsl_tunable_t& tunable)
+{
+    static const std::map<std::string, GLenum> types = {
+        {"float", GL_FLOAT}, {"int", GL_INT}, {"vec2", GL_FLOAT_VEC2},
+        {"vec3", GL_FLOAT_VEC3}, {"vec4", GL_FLOAT_VEC4},
+    };
+
+    return types.at(tunable.type);
+}
+
+/*
+ * Upload @count floats from @value to the uniform @name of the bound
+ * @shader. Programs keep their uniforms between draws, so nothing is
+ * uploaded if the uniform already holds the value, or is not used.
+ */
+static void set_uniform(filter_program_t *shader, const std::string& name,
+    const float *value, size_t count)
+{
+    auto it = shader->active_uniforms.find(name);
+    if (it == shader->active_uniforms.end())
+    {
+        return;
+    }
+
+    auto& uniform = it->second;
+    if ((uniform.value.size() == count) && std::equal(value, value + count, uniform.value.begin()))
+    {
+        return;
+    }
+
+    uniform.value.assign(value, value + count);
+    switch (uniform.type)
+    {
+      case GL_INT:
+      case GL_BOOL:
+      case GL_SAMPLER_2D:
+      case GL_SAMPLER_3D:
+        GL_CALL(glUniform1i(uniform.location, value[0]));
+        break;
+
+      case GL_FLOAT_VEC2:
+        GL_CALL(glUniform2fv(uniform.location, 1, value));
+        break;
+
+      case GL_FLOAT_VEC3:
+        GL_CALL(glUniform3fv(uniform.location, 1, value));
+        break;
+
+      case GL_FLOAT_VEC4:
+        GL_CALL(glUniform4fv(uniform.location, 1, value));
+        break;
+
+      case GL_FLOAT_MAT4:
+        GL_CALL(glUniformMatrix4fv(uniform.location, 1, GL_FALSE, value));
+        break;
+
+      default:
+        GL_CALL(glUniform1f(uniform.location, value[0]));
+        break;
+    }
+}
+
+static void set_uniform(filter_program_t *shader, const std::string& name, float value)
+{
+    set_uniform(shader, name, &value, 1);
+}
+
+static void set_uniform(filter_program_t *shader, const std::string& name, const glm::vec4& value)
+{
+    set_uniform(shader, name, &value[0], 4);
+}
+
+static void set_uniform(filter_program_t *shader, const std::string& name, const glm::mat4& value)
+{
+    set_uniform(shader, name, &value[0][0], 16);
+}
+
+static void upload_uniforms(filter_program_t *shader,
+    const std::map<std::string, uniform_value_t>& uniforms)
+{
+    for (auto& [name, uniform] : uniforms)
+    {
+        set_uniform(shader, name, uniform.value.data(), uniform.value.size());
+    }
+}
+
+/*
+ * Bind the vertex array drawing a quad over the whole viewport with
+ * @shader, with the texture upside down if @flip is set. The arrays are
+ * created on first use, as vertex arrays belong to the context they are
+ * created in and programs may be linked on the loader thread.
+ */
+static void bind_quad(filter_program_t *shader, bool flip)
+{
+    static const float vertexData[] = {
+        /* position */
+        -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f,
+        /* texcoord */
+        0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f,
+        /* flipped texcoord */
+        0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f,
+    };
+
+    if (!shader->quad_vbo)
+    {
+        GL_CALL(glGenBuffers(1, &shader->quad_vbo));
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, shader->quad_vbo));
+        GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW));
+        GL_CALL(glGenVertexArrays(2, shader->quad_vaos));
+        for (int i = 0; i < 2; i++)
+        {
+            GL_CALL(glBindVertexArray(shader->quad_vaos[i]));
+            if (shader->position_location >= 0)
+            {
+                GL_CALL(glEnableVertexAttribArray(shader->position_location));
+                GL_CALL(glVertexAttribPointer(shader->position_location, 2, GL_FLOAT, GL_FALSE, 0,
+                    (void*)0));
+            }
+
+            if (shader->texcoord_location >= 0)
+            {
+                GL_CALL(glEnableVertexAttribArray(shader->texcoord_location));
+                GL_CALL(glVertexAttribPointer(shader->texcoord_location, 2, GL_FLOAT, GL_FALSE, 0,
+                    (void*)(sizeof(float) * 8 * (i + 1))));
+            }
+        }
+
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    }
+
+    GL_CALL(glBindVertexArray(shader->quad_vaos[flip ? 1 : 0]));
+}
+
+/* Bind @lut to the active texture unit, uploading it on first use */
+static void bind_lut(lut_texture_t *lut)
+{
+    if (lut->tex)
+    {
+        GL_CALL(glBindTexture(GL_TEXTURE_3D, lut->tex));
+        return;
+    }
+
+    int size = lut->lut.size;
+    GL_CALL(glGenTextures(1, &lut->tex));
+    GL_CALL(glBindTexture(GL_TEXTURE_3D, lut->tex));
+    GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+    GL_CALL(glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, size, size, size, 0, GL_RGB, GL_FLOAT,
+        lut->lut.data.data()));
+}
+
+/* A number, boolean or array of up to four numbers */
+static bool json_to_floats(const wf::json_t& json, std::vector<float>& value)
+{
+    auto to_float = [] (const wf::json_t& item, float& out)
+    {
+        if (item.is_bool())
+        {
+            out = item.as_bool();
+        } else if (item.is_int())
+        {
+            out = item.as_int();
+        } else if (item.is_double())
+        {
+            out = item.as_double();
+        } else
+        {
+            return false;
+        }
+
+        return true;
+    };
+
+    value.clear();
+    if (!json.is_array())
+    {
+        value.resize(1);
+        return to_float(json, value[0]);
+    }
+
+    if ((json.size() < 1) || (json.size() > 4))
+    {
+        return false;
+    }
+
+    value.resize(json.size());
+    for (size_t i = 0; i < json.size(); i++)
+    {
+        if (!to_float(json[i], value[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Set uniforms of the shader stages of @chain from a JSON object mapping
+ * uniform names to values, see json_to_floats(). Every name must be an
+ * active uniform of at least one stage, with a matching number of
+ * components, and values are clamped to the range of tunables. Nothing is
+ * changed if any entry is invalid. Returns an error message or "".
+ */
+static std::string set_chain_uniforms(filter_chain_t& chain, const wf::json_t& uniforms)
+{
+    static const std::vector<std::string> reserved = {"mvp", "progress", "in_tex", "margins", "time"};
+    if (!uniforms.is_object())
+    {
+        return "uniforms must be an object";
+    }
+
+    std::vector<std::pair<filter_stage_t*, std::pair<std::string, uniform_value_t>>> updates;
+    for (auto& name : uniforms.get_member_names())
+    {
+        if (name.empty() || (name[0] == '_') ||
+            (std::find(reserved.begin(), reserved.end(), name) != reserved.end()))
+        {
+            return "Uniform " + name + " cannot be set";
+        }
+
+        std::vector<float> value;
+        if (!json_to_floats(uniforms[name], value))
+        {
+            return "Invalid value for uniform " + name;
+        }
+
+        bool found = false;
+        for (auto& stage : chain.stages)
+        {
+            if (stage.blur || stage.lut)
+            {
+                continue;
+            }
+
+            /* Constants are compiled in, see program_cache_t::specialize() */
+            GLenum type;
+            auto& active = stage.programs[0]->active_uniforms;
+            auto it = active.find(name);
+            auto constant = std::find_if(stage.tunables.begin(), stage.tunables.end(),
+                [&] (const glsl_tunable_t& tunable) { return tunable.constant && (tunable.name == name); });
+            if (constant != stage.tunables.end())
+            {
+                type = tunable_type(*constant);
+            } else if (it != active.end())
+            {
+                type = it->second.type;
+            } else
+            {
+                continue;
+            }
+
+            if (uniform_components(type) == 0)
+            {
+                return "Uniform " + name + " cannot be set";
+            }
+
+            if (uniform_components(type) != value.size())
+            {
+                return "Uniform " + name + " has " + std::to_string(uniform_components(type)) +
+                       " components";
+            }
+
+            auto clamped = value;
+            for (auto& tunable : stage.tunables)
+            {
+                for (size_t i = 0; (tunable.name == name) && (i < tunable.min.size()); i++)
+                {
+                    clamped[i] = std::clamp(clamped[i], tunable.min[i], std::max(tunable.min[i], tunable.max[i]));
+                }
+            }
+
+            found = true;
+            updates.push_back({&stage, {name, {type, clamped}}});
+        }
+
+        if (!found)
+        {
+            return "No active uniform " + name;
+        }
+    }
+
+    for (auto& [stage, uniform] : updates)
+    {
+        stage->uniforms[uniform.first] = uniform.second;
+    }
+
+    return "";
+}
+
+/* Whether @a and @b name the same files and built-in passes, ignoring their sources */
+static bool same_passes(const std::vector<filter_pass_t>& a, const std::vector<filter_pass_t>& b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+        [] (const filter_pass_t& x, const filter_pass_t& y)
+    {
+        return (x.path == y.path) && (x.blur.has_value() == y.blur.has_value()) &&
+               (!x.blur || ((x.blur->radius == y.blur->radius) && (x.blur->iterations == y.blur->iterations)));
+    });
+}
+
+/*
+ * Replace the stages of @chain with @stages, built from new sources of the
+ * same passes. Uniforms which still exist with the same type keep the
+ * values they were set to.
+ */
+static void replace_stages(filter_chain_t& chain, std::vector<filter_stage_t> stages)
+{
+    std::map<std::string, uniform_value_t> values;
+    for (auto& stage : chain.stages)
+    {
+        values.insert(stage.uniforms.begin(), stage.uniforms.end());
+    }
+
+    for (auto& stage : stages)
+    {
+        for (auto& [name, uniform] : stage.uniforms)
+        {
+            auto it = values.find(name);
+            if ((it != values.end()) && (it->second.type == uniform.type) &&
+                (it->second.value.size() == uniform.value.size()))
+            {
+                uniform = it->second;
+            }
+        }
+    }
+
+    chain.stages = std::move(stages);
+}
+
+/*
+ * A bound on how far the blur reads from its input: every pass reaches a
+ * few pixels of its level, which are 2^level input pixels large. Summed
+ * over the passes down to the last level and back up, that is less than
+ * 2^(iterations + 1) times as far.
+ */
+static float blur_sampling_radius(const blur_params_t& blur)
+{
+    int iterations = std::clamp(blur.iterations, 1, 8);
+    return (1.5 * blur.radius + 3.0) * (2 << iterations);
+}
+
+/*
+ * Dual Kawase blur: the input is halved in size for every iteration, then
+ * scaled back up again, and the last upsample draws at full size. Each
+ * pass reads only a few bilinear taps, so a wide blur costs a fraction of
+ * sampling it at full resolution. @draw is as in run_filter_chain().
+ */
+template<class Draw>
+static void run_blur_stage(const filter_stage_t& stage, int index, const wf::gles_texture_t& input,
+    wf::dimensions_t size, buffer_pool_t& buffers, Draw& draw, wf::auxilliary_buffer_t *target)
+{
+    int iterations = std::clamp(stage.blur->iterations, 1, 8);
+    float radius   = stage.blur->radius;
+    auto level_size = [&] (int level)
+    {
+        return wf::dimensions_t{std::max(1, size.width >> level), std::max(1, size.height >> level)};
+    };
+    auto blur_uniforms = [=] (wf::dimensions_t level)
+    {
+        return [=] (filter_program_t *program)
+        {
+            float halfpixel[] = {0.5f / level.width, 0.5f / level.height};
+            /* The taps rely on bilinear filtering */
+            use_bilinear_sampling(program);
+            set_uniform(program, "halfpixel", halfpixel, 2);
+            set_uniform(program, "offset", radius);
+        };
+    };
+
+    /* levels[i] holds level i + 1, at 1 / 2^(i + 1) of the input size */
+    std::vector<std::unique_ptr<wf::auxilliary_buffer_t>> levels;
+    auto texture = input;
+    for (int i = 1; i <= iterations; i++)
+    {
+        levels.push_back(buffers.acquire(level_size(i)));
+        draw(stage.programs[0].get(), texture, levels.back().get(), blur_uniforms(level_size(i)), -1);
+        texture = wf::gles_texture_t::from_aux(*levels.back());
+    }
+
+    for (int i = iterations - 1; i >= 1; i--)
+    {
+        draw(stage.programs[1].get(), texture, levels[i - 1].get(), blur_uniforms(level_size(i)), -1);
+        texture = wf::gles_texture_t::from_aux(*levels[i - 1]);
+    }
+
+    auto final_uniforms = blur_uniforms(size);
+    draw(stage.programs[2].get(), texture, target, [&] (filter_program_t *program)
+    {
+        final_uniforms(program);
+        GL_CALL(glActiveTexture(GL_TEXTURE1));
+        GL_CALL(glBindTexture(input.target, input.tex_id));
+        set_uniform(program, "original", 1.0f);
+        GL_CALL(glActiveTexture(GL_TEXTURE0));
+    }, index);
+    GL_CALL(glActiveTexture(GL_TEXTURE1));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+    GL_CALL(glActiveTexture(GL_TEXTURE0));
+
+    for (auto& level : levels)
+    {
+        buffers.release(std::move(level));
+    }
+}
+
+/*
+ * Run every stage of @chain over @input, which is @size pixels large.
+ * @draw(program, texture, buffer, uniforms, stage) draws @texture with
+ * @program over all of @buffer, or into the real target if @buffer is
+ * nullptr. @stage is the index of the stage the draw produces the output
+ * of, or -1 for draws internal to a stage. Intermediate results ping-pong
+ * between pooled buffers, only the last stage draws into the real target.
+ */
+template<class Draw>
+static void run_filter_chain(const filter_chain_t& chain, const wf::gles_texture_t& input,
+    wf::dimensions_t size, buffer_pool_t& buffers, Draw draw)
+{
+    std::unique_ptr<wf::auxilliary_buffer_t> current;
+    auto texture = input;
+    for (size_t i = 0; i < chain.stages.size(); i++)
+    {
+        auto& stage = chain.stages[i];
+        std::unique_ptr<wf::auxilliary_buffer_t> next;
+        if (i + 1 < chain.stages.size())
+        {
+            next = buffers.acquire(size);
+        }
+
+        if (stage.blur)
+        {
+            run_blur_stage(stage, i, texture, size, buffers, draw, next.get());
+        } else if (stage.lut)
+        {
+            draw(stage.programs[0].get(), texture, next.get(), [&] (filter_program_t *program)
+            {
+                auto& lut = stage.lut->lut;
+                float scale[3], offset[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    scale[c]  = (lut.size - 1.0f) / (lut.size * (lut.domain_max[c] - lut.domain_min[c]));
+                    offset[c] = 0.5f / lut.size - lut.domain_min[c] * scale[c];
+                }
+
+                set_uniform(program, "lut_scale", scale, 3);
+                set_uniform(program, "lut_offset", offset, 3);
+                GL_CALL(glActiveTexture(GL_TEXTURE1));
+                bind_lut(stage.lut.get());
+                set_uniform(program, "lut", 1.0f);
+                GL_CALL(glActiveTexture(GL_TEXTURE0));
+            }, (int)i);
+            GL_CALL(glActiveTexture(GL_TEXTURE1));
+            GL_CALL(glBindTexture(GL_TEXTURE_3D, 0));
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+        } else
+        {
+            uniform_setter_t uniforms;
+            if (!stage.uniforms.empty())
+            {
+                uniforms = [&] (filter_program_t *program) { upload_uniforms(program, stage.uniforms); };
+            }
+
+            draw(stage.programs[0].get(), texture, next.get(), uniforms, (int)i);
+        }
+
+        buffers.release(std::move(current));
+        current = std::move(next);
+        if (current)
+        {
+            texture = wf::gles_texture_t::from_aux(*current);
+        }
+    }
+
+    buffers.release(std::move(current));
+}
+
+/*
+ * Plugin-wide cache of linked programs, keyed by the hash of the fragment
+ * shader source. Filters only draw RGBA textures, so every program is used
+ * as its RGBA variant. The cache only holds weak references, so a program
+ * is freed as soon as the last view or output using it lets go.
+ */
+class program_cache_t
+{
+    std::map<uint64_t, std::weak_ptr<filter_program_t>> programs;
+    program_binary_cache_t binaries;
+    wf::option_wrapper_t<bool> binary_cache{"filters/binary_cache"};
+    /* Specialized variants in use lately, most recent first, see specialize() */
+    std::list<std::shared_ptr<filter_program_t>> recent_variants;
+    static constexpr size_t max_recent_variants = 16;
+
+    void touch_variant(std::shared_ptr<filter_program_t> shader)
+    {
+        recent_variants.remove(shader);
+        recent_variants.push_front(shader);
+        if (recent_variants.size() > max_recent_variants)
+        {
+            recent_variants.pop_back();
+        }
+    }
+
+    void prune()
+    {
+        for (auto it = programs.begin(); it != programs.end();)
+        {
+            if (it->second.expired())
+            {
+                it = programs.erase(it);
+            } else
+            {
+                ++it;
+            }
+        }
+    }
+
+  public:
+    /* The LUTs used by chains, see build_stages() */
+    lut_cache_t luts;
+
+    /* Estimated GPU memory of every program in use, LUTs included */
+    size_t get_bytes()
+    {
+        prune();
+        size_t bytes = luts.get_bytes();
+        for (auto& [key, weak] : programs)
+        {
+            if (auto shader = weak.lock())
+            {
+                bytes += shader->bytes;
+            }
+        }
+
+        return bytes;
+    }
+
+    /* Find an already linked program for the given source, if any. */
+    std::shared_ptr<filter_program_t> find(const std::string& source)
+    {
+        prune();
+
+        auto it = programs.find(hash_string(source));
+        if (it != programs.end())
+        {
+            auto cached = it->second.lock();
+            if (cached && (cached->source == source))
+            {
+                return cached;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /*
+     * Allocate a new, not yet linked program. It is not visible to find()
+     * until it has been linked and adopt()ed.
+     */
+    std::shared_ptr<filter_program_t> create(const std::string& source)
+    {
+        auto shader = std::shared_ptr<filter_program_t>(new filter_program_t,
+            [] (filter_program_t *shader)
+        {
+            wf::gles::run_in_context([&]
+            {
+                if (shader->quad_vbo)
+                {
+                    GL_CALL(glDeleteVertexArrays(2, shader->quad_vaos));
+                    GL_CALL(glDeleteBuffers(1, &shader->quad_vbo));
+                }
+
+                shader->program.free_resources();
+            });
+            delete shader;
+        });
+        shader->source    = source;
+        shader->hash      = hash_string(source);
+        shader->type      = wf::TEXTURE_TYPE_RGBA;
+        shader->cacheable = source.find("gl_FragCoord") == std::string::npos;
+        return shader;
+    }
+
+    /*
+     * Link a program created with create(). Requires either the renderer's
+     * GL context or a context sharing objects with it to be current, and
+     * may be called from the shader loader thread. Returns true if the
+     * program binary was loaded from disk.
+     */
+    bool link(filter_program_t *shader, bool use_binaries)
+    {
+        GLuint id = use_binaries ? binaries.load(shader->source, shader->type) : 0;
+        if (id)
+        {
+            shader->program.set_simple(id, shader->type);
+            query_interface(shader);
+            return true;
+        }
+
+        shader->program.compile(vertex_shader, shader->source);
+        if (use_binaries)
+        {
+            binaries.store(shader->source, shader->type, shader->program.get_program_id(shader->type));
+        }
+
+        query_interface(shader);
+        return false;
+    }
+
+    /* Resolve the locations of the attributes and active uniforms once */
+    static void query_interface(filter_program_t *shader)
+    {
+        GLuint id = shader->program.get_program_id(shader->type);
+        if (id == 0)
+        {
+            return;
+        }
+
+        GLint length = 0;
+        GL_CALL(glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length));
+        shader->bytes = std::max<GLint>(length, 0);
+
+        GL_CALL(shader->position_location = glGetAttribLocation(id, "position"));
+        GL_CALL(shader->texcoord_location = glGetAttribLocation(id, "texcoord"));
+
+        GLint count = 0;
+        GL_CALL(glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count));
+        for (GLint i = 0; i < count; i++)
+        {
+            char name[256];
+            GLsizei length;
+            GLint size;
+            GLenum type;
+            GL_CALL(glGetActiveUniform(id, i, sizeof(name), &length, &size, &type, name));
+
+            /* Arrays are reported as name[0] */
+            std::string uniform_name(name, length);
+            auto& uniform = shader->active_uniforms[uniform_name.substr(0, uniform_name.find('['))];
+            uniform.type = type;
+            GL_CALL(uniform.location = glGetUniformLocation(id, name));
+        }
+    }
+
+    /*
+     * Register a linked program so that later users share it. If an
+     * identical program was registered in the meantime, that one is
+     * returned instead.
+     */
+    std::shared_ptr<filter_program_t> adopt(std::shared_ptr<filter_program_t> shader)
+    {
+        if (auto cached = find(shader->source))
+        {
+            return cached;
+        }
+
+        programs[shader->hash] = shader;
+        return shader;
+    }
+
+    bool use_binary_cache()
+    {
+        return binary_cache;
+    }
+
+    std::shared_ptr<filter_program_t> acquire(const std::string& source,
+        program_cache_result_t *result = nullptr)
+    {
+        if (auto cached = find(source))
+        {
+            if (result)
+            {
+                *result = PROGRAM_CACHE_SHARED;
+            }
+
+            return cached;
+        }
+
+        auto shader = create(source);
+        bool hit    = false;
+        wf::gles::run_in_context([&]
+        {
+            hit = link(shader.get(), binary_cache);
+        });
+        if (shader->program.get_program_id(shader->type) == 0)
+        {
+            return nullptr;
+        }
+
+        LOGI("Shader binary cache ", hit ? "hit" : "miss", " for program ", hash_to_hex(shader->hash));
+        if (result)
+        {
+            *result = hit ? PROGRAM_CACHE_DISK_HIT : PROGRAM_CACHE_MISS;
+        }
+
+        return adopt(shader);
+    }
+
+    /*
+     * Build the stages for a chain of passes. Runs of shader passes are
+     * fused where possible, see glsl_plan_chain(), and a fused program
+     * which fails to link is replaced by its separately linked passes.
+     * @get_program returns the program for a source, nullptr if it does not
+     * link. @ok is cleared if any program is missing.
+     */
+    static std::vector<filter_stage_t> build_stages(const std::vector<filter_pass_t>& passes,
+        lut_cache_t& luts, std::function<std::shared_ptr<filter_program_t>(const std::string&)> get_program,
+        bool *ok)
+    {
+        std::vector<filter_stage_t> stages;
+        std::vector<std::string> sources;
+        std::vector<const filter_pass_t*> lut_passes;
+        *ok = true;
+
+        auto add_shader = [&] (const std::string& source, const std::vector<std::string>& passes)
+        {
+            filter_stage_t stage;
+            stage.sampling_radius = 0.0;
+            stage.edge_only  = true;
+            stage.color_only = true;
+            for (auto& pass : passes)
+            {
+                auto metadata = glsl_parse_metadata(pass);
+                auto& band    = metadata.needs_margins ? stage.window_band : stage.texture_band;
+                band.insert(band.end(), metadata.edge_band.begin(), metadata.edge_band.end());
+                stage.edge_only &= !metadata.edge_band.empty();
+                if (!metadata.sampling_radius_uniform.empty())
+                {
+                    /* Follows the uniform's current value, see get_sampling_radius() */
+                    stage.radius_uniforms.push_back(metadata.sampling_radius_uniform);
+                    metadata.sampling_radius = 0.0;
+                }
+
+                stage.sampling_radius = ((stage.sampling_radius < 0.0) || (metadata.sampling_radius < 0.0)) ?
+                    -1.0 : stage.sampling_radius + metadata.sampling_radius;
+                stage.time_dependent |= metadata.time_dependent;
+                stage.color_only     &= metadata.color_only;
+                stage.needs_margins  |= metadata.needs_margins;
+                if ((metadata.max_fps > 0.0) && ((stage.max_fps == 0.0) || (metadata.max_fps < stage.max_fps)))
+                {
+                    stage.max_fps = metadata.max_fps;
+                }
+
+                for (auto& tunable : metadata.tunables)
+                {
+                    /* Fused passes never declare the same tunable, see glsl_plan_chain() */
+                    if (!stage.uniforms.count(tunable.name))
+                    {
+                        stage.tunables.push_back(tunable);
+                        stage.uniforms[tunable.name] = {tunable_type(tunable), tunable.value};
+                    }
+                }
+            }
+
+            auto constants = stage.get_constants();
+            auto shader    = get_program(glsl_specialize(source, constants));
+            if (!shader)
+            {
+                return false;
+            }
+
+            stage.programs = {shader};
+            stage.base_source = constants.empty() ? "" : source;
+            stages.push_back(stage);
+            return true;
+        };
+
+        auto flush_shaders = [&] ()
+        {
+            for (auto& stage : glsl_plan_chain(sources))
+            {
+                if (!stage.source.empty() && add_shader(stage.source, stage.passes))
+                {
+                    continue;
+                }
+
+                if (stage.source.empty() || (stage.passes.size() > 1))
+                {
+                    for (auto& pass : stage.passes)
+                    {
+                        *ok &= add_shader(pass, {pass});
+                    }
+                } else
+                {
+                    *ok = false;
+                }
+            }
+
+            sources.clear();
+        };
+
+        /* Consecutive LUTs become a single lookup */
+        auto flush_luts = [&] ()
+        {
+            if (lut_passes.empty())
+            {
+                return;
+            }
+
+            filter_stage_t stage;
+            stage.lut = luts.acquire(lut_passes);
+            stage.programs = {get_program(lut_fragment_shader)};
+            stage.sampling_radius = 0.0;
+            stage.color_only = true;
+            *ok &= stage.lut && stage.programs[0];
+            stages.push_back(stage);
+            lut_passes.clear();
+        };
+
+        for (auto& pass : passes)
+        {
+            if (is_lut_pass(pass))
+            {
+                flush_shaders();
+                lut_passes.push_back(&pass);
+                continue;
+            }
+
+            flush_luts();
+            if (!pass.blur)
+            {
+                sources.push_back(pass.source);
+                continue;
+            }
+
+            flush_shaders();
+            filter_stage_t stage;
+            stage.blur = pass.blur;
+            stage.sampling_radius = blur_sampling_radius(*pass.blur);
+            for (auto source : {blur_down_fragment_shader, blur_up_fragment_shader,
+                blur_final_fragment_shader})
+            {
+                auto shader = get_program(source);
+                *ok &= (shader != nullptr);
+                stage.programs.push_back(shader);
+            }
+
+            stages.push_back(stage);
+        }
+
+        flush_shaders();
+        flush_luts();
+        return stages;
+    }
+
+    /*
+     * Switch every stage of @chain whose constants were changed to the
+     * program specialized for their current values. The variants last
+     * switched between stay linked even while unused, so flipping between
+     * a few parameter sets does not link again. Returns false if a variant
+     * does not link, its stage then keeps its previous program.
+     */
+    bool specialize(filter_chain_t& chain)
+    {
+        bool ok = true;
+        for (auto& stage : chain.stages)
+        {
+            if (stage.base_source.empty())
+            {
+                continue;
+            }
+
+            auto source = glsl_specialize(stage.base_source, stage.get_constants());
+            if (source == stage.programs[0]->source)
+            {
+                continue;
+            }
+
+            auto shader = acquire(source);
+            if (!shader)
+            {
+                ok = false;
+                continue;
+            }
+
+            touch_variant(stage.programs[0]);
+            touch_variant(shader);
+            stage.programs[0] = shader;
+        }
+
+        return ok;
+    }
+
+    /*
+     * Acquire the programs for a chain of passes, see build_stages(). The
+     * reported result is the most expensive one of all programs.
+     */
+    std::shared_ptr<filter_chain_t> acquire_chain(const std::vector<filter_pass_t>& passes,
+        program_cache_result_t *result = nullptr)
+    {
+        auto chain = std::make_shared<filter_chain_t>();
+        chain->set_passes(passes);
+        program_cache_result_t chain_result = PROGRAM_CACHE_SHARED;
+
+        bool ok;
+        chain->stages = build_stages(passes, luts, [&] (const std::string& source)
+        {
+            program_cache_result_t program_result;
+            auto shader = acquire(source, &program_result);
+            if (shader)
+            {
+                chain_result = std::max(chain_result, program_result);
+            }
+
+            return shader;
+        }, &ok);
+        if (!ok)
+        {
+            return nullptr;
+        }
+
+        if (result)
+        {
+            *result = chain_result;
+        }
+
+        return chain;
+    }
+};
+
+/*
+ * Reads shader files and links programs on a worker thread, so that
+ * neither IPC clients nor the compositor's event loop wait on the
+ * filesystem or the shader compiler. Programs are linked in an EGL
+ * context sharing objects with the renderer's context. If such a context
+ * cannot be created, only the file I/O happens on the worker and the
+ * program is linked on the main thread once its source is available.
+ */
+class shader_loader_t
+{
+  public:
+    struct job_t
+    {
+        uint64_t token;
+        /* The worker fills in the sources */
+        std::vector<filter_pass_t> passes;
+        bool use_binaries;
+
+        /* Filled in by the worker thread */
+        bool read_ok    = false;
+        bool linked     = false;
+        bool link_ok    = false;
+        bool binary_hit = false;
+        /* The stages of the chain, empty if they are to be linked on the main thread */
+        std::vector<filter_stage_t> stages;
+        /* Fused programs which failed to link, released on the main thread */
+        std::vector<std::shared_ptr<filter_program_t>> discarded;
+    };
+
+    using completion_t = std::function<void (job_t&)>;
+
+    shader_loader_t(program_cache_t *programs, completion_t completion)
+    {
+        this->programs   = programs;
+        this->completion = completion;
+
+        auto renderer = wf::get_core().renderer;
+        if (wlr_renderer_is_gles2(renderer))
+        {
+            auto egl = wlr_gles2_renderer_get_egl(renderer);
+            display = wlr_egl_get_display(egl);
+            share_context = wlr_egl_get_context(egl);
+            context_attribs = get_share_attribs();
+        }
+
+        event_fd     = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        event_source = wl_event_loop_add_fd(wf::get_core().ev_loop, event_fd,
+            WL_EVENT_READABLE, on_jobs_done, this);
+        worker = std::thread([=] { run(); });
+    }
+
+    ~shader_loader_t()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+
+        cond.notify_all();
+        worker.join();
+        wl_event_source_remove(event_source);
+        close(event_fd);
+
+        /* Programs must be released on the main thread */
+        done.clear();
+    }
+
+    void submit(job_t job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(std::move(job));
+        }
+
+        cond.notify_one();
+    }
+
+  private:
+    program_cache_t *programs;
+    completion_t completion;
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext share_context = EGL_NO_CONTEXT;
+    std::vector<EGLint> context_attribs;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<job_t> pending, done;
+    bool quit = false;
+
+    int event_fd;
+    wl_event_source *event_source;
+
+    bool has_egl_extension(const std::string& name)
+    {
+        const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+        return extensions && (" " + std::string(extensions) + " ").find(" " + name + " ") != std::string::npos;
+    }
+
+    /*
+     * Contexts sharing objects must agree on their reset strategy, so ask
+     * for what wlroots asks for its own context. The priority of the
+     * renderer's context is queried, as the driver may not grant it.
+     */
+    std::vector<EGLint> get_share_attribs()
+    {
+        std::vector<EGLint> attribs = {EGL_CONTEXT_CLIENT_VERSION, 2};
+        if (has_egl_extension("EGL_EXT_create_context_robustness"))
+        {
+            attribs.push_back(EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_EXT);
+            attribs.push_back(EGL_LOSE_CONTEXT_ON_RESET_EXT);
+        }
+
+        EGLint priority;
+        if (has_egl_extension("EGL_IMG_context_priority") &&
+            eglQueryContext(display, share_context, EGL_CONTEXT_PRIORITY_LEVEL_IMG, &priority))
+        {
+            attribs.push_back(EGL_CONTEXT_PRIORITY_LEVEL_IMG);
+            attribs.push_back(priority);
+        }
+
+        attribs.push_back(EGL_NONE);
+        return attribs;
+    }
+
+    EGLContext create_shared_context()
+    {
+        if (share_context == EGL_NO_CONTEXT)
+        {
+            LOGI("Renderer is not GLES, shaders are linked on the main thread.");
+            return EGL_NO_CONTEXT;
+        }
+
+        eglBindAPI(EGL_OPENGL_ES_API);
+        EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, share_context,
+            context_attribs.data());
+        if (context == EGL_NO_CONTEXT)
+        {
+            LOGE("Failed to create shared EGL context (error ", eglGetError(),
+                "), shaders are linked on the main thread.");
+            return EGL_NO_CONTEXT;
+        }
+
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            LOGE("Failed to make shared EGL context current (error ", eglGetError(),
+                "), shaders are linked on the main thread.");
+            eglDestroyContext(display, context);
+            return EGL_NO_CONTEXT;
+        }
+
+        return context;
+    }
+
+    void run()
+    {
+        EGLContext context = create_shared_context();
+        while (true)
+        {
+            job_t job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return quit || !pending.empty(); });
+                if (quit)
+                {
+                    break;
+                }
+
+                job = std::move(pending.front());
+                pending.pop_front();
+            }
+
+            job.read_ok = load_shader_sources(job.passes);
+            if (job.read_ok && (context != EGL_NO_CONTEXT))
+            {
+                link_chain(job);
+                /* Make sure the programs are complete before the renderer uses them */
+                glFinish();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.push_back(std::move(job));
+            }
+
+            uint64_t one = 1;
+            if (write(event_fd, &one, sizeof(one)) < 0)
+            {
+                /* The counter is saturated, the main thread will wake up anyway */
+            }
+        }
+
+        if (context != EGL_NO_CONTEXT)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+        }
+    }
+
+    /* Same as program_cache_t::acquire_chain(), without touching the cache itself */
+    void link_chain(job_t& job)
+    {
+        job.linked     = true;
+        job.binary_hit = true;
+        job.stages     = program_cache_t::build_stages(job.passes, programs->luts,
+            [&] (const std::string& source) -> std::shared_ptr<filter_program_t>
+        {
+            auto shader = programs->create(source);
+            job.binary_hit &= programs->link(shader.get(), job.use_binaries);
+            if (shader->program.get_program_id(shader->type) == 0)
+            {
+                job.discarded.push_back(shader);
+                return nullptr;
+            }
+
+            return shader;
+        }, &job.link_ok);
+    }
+
+    static int on_jobs_done(int fd, uint32_t mask, void *data)
+    {
+        auto self = (shader_loader_t*)data;
+        uint64_t count;
+        if (read(fd, &count, sizeof(count)) < 0)
+        {
+            return 0;
+        }
+
+        std::deque<job_t> finished;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            std::swap(finished, self->done);
+        }
+
+        for (auto& job : finished)
+        {
+            self->completion(job);
+        }
+
+        return 0;
+    }
+};
+
+/*
+ * Watches shader files with inotify and reports them as changed once they
+ * have been left alone for a moment, as editors tend to write a file in
+ * several steps. Directories are watched rather than the files, so files
+ * replaced by renaming a new file over them are noticed too.
+ */
+class shader_watcher_t
+{
+  public:
+    using callback_t = std::function<void (const std::set<std::string>&)>;
+
+    shader_watcher_t(callback_t changed)
+    {
+        this->changed = changed;
+
+        auto loop = wf::get_core().ev_loop;
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0)
+        {
+            LOGE("Failed to initialize inotify, shaders will not be reloaded.");
+        } else
+        {
+            event_source = wl_event_loop_add_fd(loop, inotify_fd, WL_EVENT_READABLE, on_inotify_event, this);
+        }
+
+        timer = wl_event_loop_add_timer(loop, on_timeout, this);
+    }
+
+    ~shader_watcher_t()
+    {
+        wl_event_source_remove(timer);
+        if (inotify_fd >= 0)
+        {
+            wl_event_source_remove(event_source);
+            close(inotify_fd);
+        }
+    }
+
+    /* Watch exactly the files at @paths from now on */
+    void set_paths(const std::set<std::string>& paths)
+    {
+        files.clear();
+        std::set<std::string> wanted;
+        for (auto& path : paths)
+        {
+            std::error_code ec;
+            auto file = std::filesystem::absolute(path, ec).lexically_normal();
+            if (!ec)
+            {
+                files[file.string()].insert(path);
+                wanted.insert(file.parent_path().string());
+            }
+        }
+
+        if (inotify_fd < 0)
+        {
+            return;
+        }
+
+        for (auto it = dirs.begin(); it != dirs.end();)
+        {
+            if (wanted.erase(it->second))
+            {
+                ++it;
+            } else
+            {
+                inotify_rm_watch(inotify_fd, it->first);
+                it = dirs.erase(it);
+            }
+        }
+
+        for (auto& dir : wanted)
+        {
+            int wd = inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd < 0)
+            {
+                LOGE("Failed to watch ", dir, " for shader changes.");
+                continue;
+            }
+
+            dirs[wd] = dir;
+        }
+    }
+
+  private:
+    /* How long files must stay untouched before they are reloaded */
+    static constexpr int debounce_ms = 150;
+
+    callback_t changed;
+    int inotify_fd;
+    wl_event_source *event_source = nullptr;
+    wl_event_source *timer;
+    /* Watched directories by watch descriptor */
+    std::map<int, std::string> dirs;
+    /* The paths as given to set_paths(), by normalized absolute path */
+    std::map<std::string, std::set<std::string>> files;
+    std::set<std::string> pending;
+
+    static int on_inotify_event(int fd, uint32_t mask, void *data)
+    {
+        auto self = (shader_watcher_t*)data;
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *ptr = buffer; ptr < buffer + length;)
+            {
+                auto event = (inotify_event*)ptr;
+                ptr += sizeof(inotify_event) + event->len;
+
+                auto dir = self->dirs.find(event->wd);
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    /* Events were lost, anything may have changed */
+                    for (auto& [file, paths] : self->files)
+                    {
+                        self->pending.insert(paths.begin(), paths.end());
+                    }
+                } else if (event->mask & IN_IGNORED)
+                {
+                    if (dir != self->dirs.end())
+                    {
+                        self->dirs.erase(dir);
+                    }
+                } else if ((dir != self->dirs.end()) && (event->len > 0))
+                {
+                    auto file  = (std::filesystem::path(dir->second) / event->name).string();
+                    auto paths = self->files.find(file);
+                    if (paths != self->files.end())
+                    {
+                        self->pending.insert(paths->second.begin(), paths->second.end());
+                    }
+                }
+            }
+        }
+
+        if (!self->pending.empty())
+        {
+            wl_event_source_timer_update(self->timer, debounce_ms);
+        }
+
+        return 0;
+    }
+
+    static int on_timeout(void *data)
+    {
+        auto self = (shader_watcher_t*)data;
+        std::set<std::string> paths;
+        std::swap(paths, self->pending);
+        self->changed(paths);
+        return 0;
+    }
+};
+
+/*
+ * Drives the time uniform of a filter and redraws it while its chain is
+ * time dependent. Each time the filter is drawn, a timer is armed to
+ * damage it again one frame at its frame rate cap later. A filter which
+ * is not drawn, e.g. on a hidden workspace, takes no frames of its own,
+ * and static filters never arm the timer.
+ */
+class frame_scheduler_t
+{
+  public:
+    frame_scheduler_t(std::function<void ()> damage)
+    {
+        this->damage = damage;
+        timer = wl_event_loop_add_timer(wf::get_core().ev_loop, on_timeout, this);
+        restart();
+    }
+
+    ~frame_scheduler_t()
+    {
+        wl_event_source_remove(timer);
+    }
+
+    /* Start the time uniform over from 0, for a newly applied filter */
+    void restart()
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    /* Seconds since the filter was applied, the value of the time uniform */
+    float get_time() const
+    {
+        return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /*
+     * Schedule the next frame after the filter was drawn on @output, at
+     * most @max_fps times a second, or at the output's refresh rate if 0.
+     */
+    void frame_drawn(float max_fps, wf::output_t *output)
+    {
+        if (armed)
+        {
+            return;
+        }
+
+        if ((max_fps <= 0.0) && output && (output->handle->refresh > 0))
+        {
+            max_fps = output->handle->refresh / 1000.0;
+        }
+
+        /* Keep the cadence of the previous frames, but never catch up on missed ones */
+        auto now = std::chrono::steady_clock::now();
+        auto interval = std::chrono::duration<double>(1.0 / ((max_fps > 0.0) ? max_fps : 60.0));
+        next_frame = std::max<std::chrono::steady_clock::time_point>(
+            next_frame + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval), now);
+        auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(next_frame - now).count();
+
+        armed = true;
+        wl_event_source_timer_update(timer, std::max<int>(1, delay));
+    }
+
+  private:
+    std::function<void ()> damage;
+    wl_event_source *timer;
+    std::chrono::steady_clock::time_point start, next_frame;
+    bool armed = false;
+
+    static int on_timeout(void *data)
+    {
+        auto self = (frame_scheduler_t*)data;
+        self->armed = false;
+        self->damage();
+        return 0;
+    }
+};
+
+/*
+ * Estimates the GPU memory held by filters, and keeps it within
+ * filters/memory_budget. Each view render instance and output registers
+ * an entry and touches it whenever it is drawn. While the total is over
+ * budget, the free buffers of the pool are dropped first, then cached
+ * results in least recently used order. Targets whose cache was evicted
+ * filter straight into the output until there is room for it again.
+ */
+class memory_tracker_t
+{
+  public:
+    struct entry_t
+    {
+        /* {"view-id": ...} or {"output-name": ...} */
+        wf::json_t owner;
+        /* The input of a view, held by Wayfire as long as it is filtered */
+        size_t input_bytes = 0;
+        /* The cached result, freed by evict() */
+        size_t cache_bytes   = 0;
+        size_t program_bytes = 0;
+        uint64_t last_used   = 0;
+        bool evicted = false;
+        std::function<void ()> evict;
+    };
+
+    ~memory_tracker_t()
+    {
+        if (idle)
+        {
+            wl_event_source_remove(idle);
+        }
+    }
+
+    void add(entry_t *entry)
+    {
+        entries.insert(entry);
+    }
+
+    void remove(entry_t *entry)
+    {
+        entries.erase(entry);
+    }
+
+    /* Mark @entry as drawn with @chain, the budget is enforced once the frame is done */
+    void touch(entry_t *entry, const filter_chain_t& chain)
+    {
+        entry->last_used     = ++clock;
+        entry->program_bytes = chain.get_program_bytes();
+        if ((get_budget() > 0) && !idle)
+        {
+            idle = wl_event_loop_add_idle(wf::get_core().ev_loop, on_idle, this);
+        }
+    }
+
+    /*
+     * Whether @entry may cache a result of @bytes. An evicted entry only
+     * gets its cache back once it fits with a tenth of the budget to
+     * spare, so that it is not evicted again right away.
+     */
+    bool readmit(entry_t *entry, size_t bytes)
+    {
+        auto budget = get_budget();
+        if (entry->evicted && ((budget == 0) || ((get_total() + bytes) * 10 <= budget * 9)))
+        {
+            entry->evicted = false;
+        }
+
+        return !entry->evicted;
+    }
+
+    /* 0 if unlimited */
+    size_t get_budget()
+    {
+        return (size_t)std::max(0, (int)budget_option) << 20;
+    }
+
+    size_t get_total()
+    {
+        size_t total = buffers->get_free_bytes() + programs->get_bytes();
+        for (auto entry : entries)
+        {
+            total += entry->input_bytes + entry->cache_bytes;
+        }
+
+        return total;
+    }
+
+    wf::json_t to_json()
+    {
+        auto views   = wf::json_t::array();
+        auto outputs = wf::json_t::array();
+        for (auto entry : entries)
+        {
+            auto item = entry->owner;
+            item["input"]    = (uint64_t)entry->input_bytes;
+            item["cache"]    = (uint64_t)entry->cache_bytes;
+            item["programs"] = (uint64_t)entry->program_bytes;
+            item["evicted"]  = entry->evicted;
+            (item.has_member("view-id") ? views : outputs).append(item);
+        }
+
+        wf::json_t json;
+        json["total"]    = (uint64_t)get_total();
+        json["budget"]   = (uint64_t)get_budget();
+        json["programs"] = (uint64_t)programs->get_bytes();
+        json["pool"]     = (uint64_t)buffers->get_free_bytes();
+        json["views"]    = views;
+        json["outputs"]  = outputs;
+        return json;
+    }
+
+  private:
+    wf::shared_data::ref_ptr_t<program_cache_t> programs;
+    wf::shared_data::ref_ptr_t<buffer_pool_t> buffers;
+    wf::option_wrapper_t<int> budget_option{"filters/memory_budget"};
+    std::set<entry_t*> entries;
+    uint64_t clock = 0;
+    wl_event_source *idle = nullptr;
+    /* Only warn once about each time the budget cannot be met */
+    bool warned = false;
+
+    void enforce()
+    {
+        auto budget = get_budget();
+        auto total  = get_total();
+        if ((budget == 0) || (total <= budget))
+        {
+            warned = false;
+            return;
+        }
+
+        total -= buffers->get_free_bytes();
+        buffers->clear();
+
+        std::vector<entry_t*> cached;
+        std::copy_if(entries.begin(), entries.end(), std::back_inserter(cached),
+            [] (entry_t *entry) { return !entry->evicted && (entry->cache_bytes > 0); });
+        std::sort(cached.begin(), cached.end(),
+            [] (entry_t *a, entry_t *b) { return a->last_used < b->last_used; });
+        for (auto entry : cached)
+        {
+            if (total <= budget)
+            {
+                break;
+            }
+
+            total -= entry->cache_bytes;
+            entry->evicted = true;
+            entry->evict();
+            entry->cache_bytes = 0;
+        }
+
+        if ((total > budget) && !warned)
+        {
+            warned = true;
+            LOGE("Filters use ", total >> 20, " MiB, over the budget of ", budget >> 20,
+                " MiB even without cached results.");
+        }
+    }
+
+    static int on_idle(void *data)
+    {
+        auto self = (memory_tracker_t*)data;
+        self->idle = nullptr;
+        self->enforce();
+        return 0;
+    }
+};
+
+/*
+ * Create or drop the stats of a filter as filters/stats is toggled.
+ * Returns nullptr while they are not collected.
+ */
+static filter_stats_t *update_stats(std::unique_ptr<filter_stats_t>& stats, bool enabled)
+{
+    if (!enabled)
+    {
+        stats.reset();
+    } else if (!stats)
+    {
+        stats = std::make_unique<filter_stats_t>();
+    }
+
+    return stats.get();
+}
+
+/*
+ * Clients watching filter state changes, see wf/filters/watch. View and
+ * output filters report their own transitions.
+ */
+class filter_events_t
+{
+  public:
+    std::set<wf::ipc::client_interface_t*> clients;
+
+    /* @event names the target with "view-id" or "output-name" */
+    void send(std::string name, wf::json_t event, const std::vector<filter_pass_t>& passes)
+    {
+        if (clients.empty())
+        {
+            return;
+        }
+
+        event["event"] = name;
+        event["shader-path"] = pass_list_to_json(passes);
+        for (auto client : clients)
+        {
+            client->send_json(event);
+        }
+    }
+};
+
+/*
+ * A filter applied to every toplevel view meeting the rule's conditions.
+ * Unset conditions match any view, app-id and title are fnmatch() patterns.
+ */
+struct filter_rule_t
+{
+    std::optional<std::string> app_id;
+    std::optional<std::string> title;
+    std::optional<std::string> output;
+    std::optional<bool> tiled;
+    std::optional<bool> focused;
+    std::optional<bool> fullscreen;
+    std::vector<filter_pass_t> passes;
+    /* Compiled once, each view gets a copy so that its uniforms are its own */
+    std::shared_ptr<filter_chain_t> chain;
+
+    bool matches(wayfire_toplevel_view view) const
+    {
+        if (app_id && fnmatch(app_id->c_str(), view->get_app_id().c_str(), 0))
+        {
+            return false;
+        }
+
+        if (title && fnmatch(title->c_str(), view->get_title().c_str(), 0))
+        {
+            return false;
+        }
+
+        if (output && (!view->get_output() || (view->get_output()->to_string() != *output)))
+        {
+            return false;
+        }
+
+        if (tiled && ((view->pending_tiled_edges() != 0) != *tiled))
+        {
+            return false;
+        }
+
+        if (focused && (view->activated != *focused))
+        {
+            return false;
+        }
+
+        return !fullscreen || (view->pending_fullscreen() == *fullscreen);
+    }
+};
+
+class wf_filters : public wf::scene::view_2d_transformer_t
+{
+    wayfire_view view;
+    /* Kept for the removed event, which may come while the view is destroyed */
+    uint64_t view_id;
+    wf::output_t *output = nullptr;
+    std::unique_ptr<wf::animation::simple_animation_t> fade;
+    bool pre_hook_set = false;
+    bool backdrop_hook_set = false;
+    wf::shared_data::ref_ptr_t<program_cache_t> programs;
+    wf::shared_data::ref_ptr_t<buffer_pool_t> buffers;
+    wf::shared_data::ref_ptr_t<filter_events_t> events;
+    wf::option_wrapper_t<bool> cache_results{"filters/cache_results"};
+    wf::option_wrapper_t<bool> batch_views{"filters/batch_views"};
+    wf::option_wrapper_t<bool> collect_stats{"filters/stats"};
+    wf::option_wrapper_t<double> backdrop_scale{"filters/backdrop_scale"};
+
+    void send_event(std::string name)
+    {
+        wf::json_t event;
+        event["view-id"] = view_id;
+        events->send(name, event, chain->passes);
+    }
+
+  public:
+    std::shared_ptr<filter_chain_t> chain;
+    std::shared_ptr<filter_program_t> passthrough;
+    /* Bumped whenever uniforms are set, so that cached results are filtered again */
+    uint64_t uniforms_serial = 0;
+    /* The rule which applied this filter, unset if it was set over IPC */
+    std::shared_ptr<filter_rule_t> rule;
+    /* Only while filters/stats is enabled */
+    std::unique_ptr<filter_stats_t> stats;
+    /* Drives the time uniform and redraws time dependent chains */
+    std::unique_ptr<frame_scheduler_t> frames;
+    /* In backdrop mode, bumped whenever something behind the view changed, see backdrop_hook */
+    uint64_t backdrop_serial = 0;
+    /* Damage of the view's own contents since the last frame, see gen_render_instances() */
+    wf::region_t own_damage;
+    /* Whether this frame redraws everything behind the view */
+    bool backdrop_fresh = false;
+    /* Set if the backdrop had to be filtered again, but could not be read back */
+    bool backdrop_stale = false;
+    /* Set while the memory budget evicted the cached backdrop */
+    bool backdrop_uncached = false;
+    class simple_node_render_instance_t : public wf::scene::transformer_render_instance_t<transformer_base_node_t>
+    {
+        wf::signal::connection_t<node_damage_signal> on_node_damaged =
+            [=] (node_damage_signal *ev)
+        {
+            cache_valid = false;
+            push_to_parent(ev->region);
+        };
+
+        wf_filters *self;
+        wayfire_view view;
+        damage_callback push_to_parent;
+        /* Set while rendering if stats are collected */
+        filter_stats_t *stats = nullptr;
+
+        /* The filtered result, reused while nothing changes */
+        wf::auxilliary_buffer_t cache;
+        bool cache_valid = false;
+        wf::shared_data::ref_ptr_t<memory_tracker_t> memory;
+        memory_tracker_t::entry_t memory_entry;
+        float cached_progress;
+        std::optional<glm::vec4> cached_margins;
+        uint64_t cached_uniforms_serial;
+
+        /* The filtered backdrop, in backdrop mode */
+        wf::auxilliary_buffer_t backdrop;
+        bool backdrop_valid = false;
+        float backdrop_progress;
+        uint64_t backdrop_serial;
+        uint64_t backdrop_uniforms_serial;
+
+        /* A filtered view drawn in the subpass of another one */
+        struct batch_member_t
+        {
+            simple_node_render_instance_t *instance;
+            wf::regionf_t damage;
+        };
+
+        /* Filters right behind this one, front to back, see schedule_instructions() */
+        std::vector<batch_member_t> batch;
+
+      public:
+        simple_node_render_instance_t(wf_filters *self, damage_callback push_damage,
+            wayfire_view view) : wf::scene::transformer_render_instance_t<transformer_base_node_t>(self,
+                push_damage,
+                view->get_output())
+        {
+            this->self = self;
+            this->view = view;
+            this->push_to_parent = push_damage;
+            self->connect(&on_node_damaged);
+
+            memory_entry.owner["view-id"] = view->get_id();
+            memory_entry.evict = [=]
+            {
+                wf::gles::run_in_context([&]
+                {
+                    cache.free();
+                    backdrop.free();
+                });
+                cache_valid    = false;
+                backdrop_valid = false;
+            };
+            memory->add(&memory_entry);
+        }
+
+        ~simple_node_render_instance_t()
+        {
+            memory->remove(&memory_entry);
+        }
+
+        /* Whether the filtered result is cached, unless the memory budget evicted it */
+        bool use_cache()
+        {
+            return self->use_cache() && !memory_entry.evicted;
+        }
+
+        /* Account the view's buffers after drawing it, see memory_tracker_t */
+        void account_memory()
+        {
+            auto bbox = self->get_children_bounding_box();
+            memory_entry.input_bytes = buffer_bytes({bbox.width, bbox.height});
+            memory_entry.cache_bytes = buffer_bytes(cache.get_size()) + buffer_bytes(backdrop.get_size());
+            memory->touch(&memory_entry, *self->chain);
+        }
+
+        /*
+         * Instructions are scheduled front to back and run back to front.
+         * If the instruction right before ours is another cached filter on
+         * the same target, nothing is drawn between the two, so we join its
+         * batch instead and are drawn first within its subpass.
+         */
+        void schedule_instructions(
+            std::vector<render_instruction_t>& instructions,
+            const wf::render_target_t& target, wf::regionf_t& damage)
+        {
+            batch.clear();
+            auto bbox = self->get_children_bounding_box();
+            memory->readmit(&memory_entry, buffer_bytes({bbox.width, bbox.height}));
+            self->backdrop_uncached = memory_entry.evicted;
+            if (!instructions.empty())
+            {
+                auto front = dynamic_cast<simple_node_render_instance_t*>(instructions.back().instance);
+                /* Empty instructions may be skipped, taking the batch with them */
+                if (front && !instructions.back().damage.empty() &&
+                    can_batch_with(front, instructions.back().target, target))
+                {
+                    front->batch.push_back({this, damage & self->get_bounding_box()});
+                    return;
+                }
+            }
+
+            // We want to render ourselves only, the node does not have children
+            instructions.push_back(render_instruction_t{
+                            .instance = this,
+                            .target   = target,
+                            .damage   = damage & self->get_bounding_box(),
+                        });
+        }
+
+        bool can_batch_with(simple_node_render_instance_t *front, const wf::render_target_t& front_target,
+            const wf::render_target_t& target)
+        {
+            return self->batch_views && use_cache() && front->use_cache() &&
+                   !self->chain->backdrop && !front->self->chain->backdrop &&
+                   (front->self->passthrough == self->passthrough) &&
+                   (front_target.get_buffer() == target.get_buffer()) &&
+                   (front_target.geometry == target.geometry) && (front_target.scale == target.scale) &&
+                   (front_target.wl_transform == target.wl_transform);
+        }
+
+        /*
+         * The margins between the view's bounding box and its window
+         * geometry, including pixdecor shadows. Only toplevels have them.
+         */
+        std::optional<glm::vec4> get_margins()
+        {
+            auto toplevel = wf::toplevel_cast(this->view);
+            if (!toplevel)
+            {
+                return {};
+            }
+
+            auto bg = view->get_surface_root_node()->get_bounding_box();
+            auto vg = toplevel->get_geometry();
+            auto margins =
+                glm::vec4{vg.x - bg.x, vg.y - bg.y, bg.width - ((vg.x - bg.x) + vg.width),
+                bg.height - ((vg.y - bg.y) + vg.height)};
+            if (view->has_data(pixdecor_custom_data_name))
+            {
+                auto decoration_margins =
+                    view->get_data<wf_shadow_margin_t>(pixdecor_custom_data_name)->get_margins();
+                margins.x += decoration_margins.left;
+                margins.y += decoration_margins.bottom;
+                margins.z += decoration_margins.right;
+                margins.w += decoration_margins.top;
+            }
+
+            // XXX: Pad the margins if there are none, so that the shader renders on the surface
+            if (bg == vg)
+            {
+                margins.x += 2.0;
+                margins.y += 2.0;
+                margins.z += 2.0;
+                margins.w += 2.0;
+            }
+
+            return margins;
+        }
+
+        /* Skip computing margins, and invalidating the cache over them, if no shader reads them */
+        std::optional<glm::vec4> chain_margins()
+        {
+            return self->chain->needs_margins() ? get_margins() : std::nullopt;
+        }
+
+        /* Bind @program for drawing @texture into @viewport of @target */
+        void begin_draw(filter_program_t *program, const wf::gles_texture_t& texture,
+            const wf::render_target_t& target, wlr_box viewport, float progress,
+            std::optional<glm::vec4> margins, const uniform_setter_t& uniforms)
+        {
+            /* Locations are resolved for the variant the program was linked as */
+            program->program.use(program->type);
+            if (stats)
+            {
+                stats->count_bind();
+            }
+
+            bind_quad(program, false);
+            set_uniform(program, "mvp", wf::gles::output_transform(target));
+            set_uniform(program, "progress", progress);
+            set_uniform(program, "in_tex", 0.0f);
+            set_uniform(program, "time", self->frames->get_time());
+            if (margins)
+            {
+                set_uniform(program, "margins", *margins);
+            }
+
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            program->program.set_active_texture(texture);
+            if (uniforms)
+            {
+                uniforms(program);
+            }
+
+            /* Render it to target */
+            wf::gles::bind_render_buffer(target);
+            GL_CALL(glViewport(viewport.x, viewport.y, viewport.width, viewport.height));
+        }
+
+        void end_draw(filter_program_t *program)
+        {
+            /* Disable stuff */
+            GL_CALL(glDisable(GL_BLEND));
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+            GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+            GL_CALL(glBindVertexArray(0));
+
+            program->program.deactivate();
+        }
+
+        /*
+         * Draw @texture with @program into @viewport of @target. If @damage
+         * is given, the draw is blended and scissored to it, otherwise the
+         * whole viewport is overwritten.
+         */
+        void draw(filter_program_t *program, const wf::gles_texture_t& texture,
+            const wf::render_target_t& target, wlr_box viewport, float progress,
+            std::optional<glm::vec4> margins, const wf::regionf_t *damage,
+            const uniform_setter_t& uniforms = {})
+        {
+            begin_draw(program, texture, target, viewport, progress, margins, uniforms);
+            if (damage)
+            {
+                GL_CALL(glEnable(GL_BLEND));
+                GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+
+                for (const auto& box : *damage)
+                {
+                    wf::gles::render_target_logic_scissor(target, box);
+                    GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                    if (stats)
+                    {
+                        stats->count_draw(true);
+                    }
+                }
+            } else
+            {
+                GL_CALL(glDisable(GL_SCISSOR_TEST));
+                GL_CALL(glClearColor(0.0, 0.0, 0.0, 0.0));
+                GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+                GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                if (stats)
+                {
+                    stats->count_draw(false);
+                }
+            }
+
+            end_draw(program);
+        }
+
+        /*
+         * The interior of the view, relative to its bounding box, which a
+         * chain of a single edge-only stage leaves unchanged, and the strips
+         * around it. Opposite margins are treated alike, so that the result
+         * does not depend on the orientation of the texture.
+         */
+        struct edge_split_t
+        {
+            wlr_box interior;
+            std::vector<wlr_box> edges;
+        };
+
+        std::optional<edge_split_t> get_edge_split()
+        {
+            auto& stages = self->chain->stages;
+            if ((stages.size() != 1) || !stages[0].edge_only)
+            {
+                return {};
+            }
+
+            /* One more pixel to be safe from rounding in the shaders */
+            auto& stage = stages[0];
+            auto bbox   = self->get_children_bounding_box();
+            int band    = std::ceil(stage.get_band_width(stage.texture_band)) + 1;
+            int inset_x = band;
+            int inset_y = band;
+            if (!stage.window_band.empty())
+            {
+                auto m = get_margins().value_or(glm::vec4(0.0));
+                int window_band = std::ceil(stage.get_band_width(stage.window_band)) + 1;
+                inset_x = std::max<int>(inset_x, std::ceil(std::max(m.x, m.z)) + window_band);
+                inset_y = std::max<int>(inset_y, std::ceil(std::max(m.y, m.w)) + window_band);
+            }
+
+            edge_split_t split;
+            split.interior = {inset_x, inset_y, bbox.width - 2 * inset_x, bbox.height - 2 * inset_y};
+            if ((split.interior.width <= 0) || (split.interior.height <= 0))
+            {
+                return {};
+            }
+
+            split.edges = {
+                {0, 0, bbox.width, inset_y},
+                {0, bbox.height - inset_y, bbox.width, inset_y},
+                {0, inset_y, inset_x, split.interior.height},
+                {bbox.width - inset_x, inset_y, inset_x, split.interior.height},
+            };
+            return split;
+        }
+
+        /*
+         * Draw over @boxes of the view only. With @damage they are blended
+         * into the target and clipped to the damage, otherwise they
+         * overwrite the viewport, which covers the bounding box.
+         */
+        void draw_boxes(const wf::render_target_t& target, const wf::regionf_t *damage,
+            const std::vector<wlr_box>& boxes)
+        {
+            if (!damage)
+            {
+                GL_CALL(glDisable(GL_BLEND));
+                GL_CALL(glEnable(GL_SCISSOR_TEST));
+                for (auto& box : boxes)
+                {
+                    GL_CALL(glScissor(box.x, box.y, box.width, box.height));
+                    GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                    if (stats)
+                    {
+                        stats->count_draw(true);
+                    }
+                }
+
+                GL_CALL(glDisable(GL_SCISSOR_TEST));
+                return;
+            }
+
+            auto bbox = self->get_children_bounding_box();
+            GL_CALL(glEnable(GL_BLEND));
+            GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+            for (auto box : boxes)
+            {
+                box.x += bbox.x;
+                box.y += bbox.y;
+                for (const auto& rect : *damage & box)
+                {
+                    wf::gles::render_target_logic_scissor(target, rect);
+                    GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                    if (stats)
+                    {
+                        stats->count_draw(true);
+                    }
+                }
+            }
+        }
+
+        /*
+         * Like draw(), for a chain of a single edge-only stage: @program
+         * only runs over the edge strips and the interior is a plain copy
+         * of @texture.
+         */
+        void draw_split(filter_program_t *program, const wf::gles_texture_t& texture,
+            const wf::render_target_t& target, wlr_box viewport, float progress,
+            std::optional<glm::vec4> margins, const wf::regionf_t *damage,
+            const uniform_setter_t& uniforms, const edge_split_t& split)
+        {
+            begin_draw(program, texture, target, viewport, progress, margins, uniforms);
+            draw_boxes(target, damage, split.edges);
+            end_draw(program);
+
+            auto passthrough = self->passthrough.get();
+            begin_draw(passthrough, texture, target, viewport, 1.0, {}, {});
+            draw_boxes(target, damage, {split.interior});
+            end_draw(passthrough);
+        }
+
+        /* Run the chain over @src_tex, only the last stage draws into @target. */
+        void run_chain(const wf::gles_texture_t& src_tex, const wf::render_target_t& target,
+            wlr_box viewport, float progress, std::optional<glm::vec4> margins,
+            const wf::regionf_t *damage)
+        {
+            auto bbox  = self->get_children_bounding_box();
+            auto split = self->passthrough ? get_edge_split() : std::nullopt;
+            run_filter_chain(*self->chain, src_tex, {bbox.width, bbox.height}, *self->buffers.get(),
+                [&] (filter_program_t *program, const wf::gles_texture_t& texture,
+                     wf::auxilliary_buffer_t *buffer, const uniform_setter_t& uniforms, int)
+            {
+                if (!buffer && split)
+                {
+                    draw_split(program, texture, target, viewport, progress, margins, damage, uniforms, *split);
+                    return;
+                }
+
+                if (!buffer)
+                {
+                    draw(program, texture, target, viewport, progress, margins, damage, uniforms);
+                    return;
+                }
+
+                auto size = buffer->get_size();
+                wf::render_target_t pass_target{*buffer};
+                pass_target.geometry = {0, 0, size.width, size.height};
+                draw(program, texture, pass_target, pass_target.geometry, progress, margins,
+                    nullptr, uniforms);
+            });
+        }
+
+        /*
+         * Re-render the filtered result into the cache buffer if the view's
+         * contents, the size or any uniform changed since the last frame.
+         */
+        void update_cache(const wf::gles_texture_t& src_tex, bool content_damaged)
+        {
+            auto bbox     = self->get_children_bounding_box();
+            auto margins  = chain_margins();
+            float progress = *self->fade;
+
+            bool dirty = !cache_valid || content_damaged || (cached_progress != progress) ||
+                (cached_margins != margins) || (cached_uniforms_serial != self->uniforms_serial);
+            if (cache.allocate({bbox.width, bbox.height}, 1.0) != wf::buffer_reallocation_result_t::SAME)
+            {
+                dirty = true;
+            }
+
+            if (!dirty)
+            {
+                return;
+            }
+
+            wf::render_target_t cache_target{cache};
+            cache_target.geometry = {0, 0, bbox.width, bbox.height};
+            run_chain(src_tex, cache_target, {0, 0, bbox.width, bbox.height}, progress, margins, nullptr);
+
+            cache_valid     = true;
+            cached_progress = progress;
+            cached_margins  = margins;
+            cached_uniforms_serial = self->uniforms_serial;
+        }
+
+        /* The view's box in framebuffer coordinates of @target */
+        wlr_box get_view_box(const wf::render_target_t& target)
+        {
+            wlr_box fb_geom = target.framebuffer_box_from_geometry_box(target.geometry);
+            auto view_box   = target.framebuffer_box_from_geometry_box(self->get_children_bounding_box());
+            view_box.x -= fb_geom.x;
+            view_box.y -= fb_geom.y;
+            return view_box;
+        }
+
+        /* Filter and draw this view alone, in a subpass of its own */
+        void render_single(wf::render_pass_t *pass, const wf::render_target_t& target,
+            const wf::regionf_t& damage)
+        {
+            auto view_box = get_view_box(target);
+
+            /* get_texture() consumes the damage of our children */
+            bool content_damaged = !cached_damage.empty();
+            auto src_tex = wf::gles_texture_t{get_texture(1.0)};
+            pass->custom_gles_subpass(target, [&]
+            {
+                stats = update_stats(self->stats, self->collect_stats);
+                if (stats)
+                {
+                    stats->begin_frame();
+                }
+
+                if (use_cache())
+                {
+                    /* Filter only when something changed, otherwise just blit the cached result */
+                    update_cache(src_tex, content_damaged);
+                    draw(self->passthrough.get(), wf::gles_texture_t::from_aux(cache),
+                        target, view_box, 1.0, {}, &damage);
+                } else
+                {
+                    cache_valid = false;
+                    cache.free();
+                    run_chain(src_tex, target, view_box, *self->fade, chain_margins(), &damage);
+                    if (self->chain->time_dependent())
+                    {
+                        self->frames->frame_drawn(self->chain->max_fps(), self->output);
+                    }
+                }
+
+                if (stats)
+                {
+                    stats->end_frame();
+                }
+            });
+            account_memory();
+        }
+
+        /* In backdrop mode, the part of the view's bounding box where the backdrop is drawn */
+        wlr_box get_backdrop_box()
+        {
+            auto bbox     = self->get_children_bounding_box();
+            auto toplevel = wf::toplevel_cast(this->view);
+            if (!toplevel)
+            {
+                return bbox;
+            }
+
+            /* Client side shadows are left out, as they are not part of the window geometry */
+            auto bg = view->get_surface_root_node()->get_bounding_box();
+            auto vg = toplevel->get_geometry();
+            wlr_box window = {bbox.x + vg.x - bg.x, bbox.y + vg.y - bg.y, vg.width, vg.height};
+            wlr_box box;
+            return wlr_box_intersection(&box, &window, &bbox) ? box : bbox;
+        }
+
+        /* The backdrop is filtered at a fraction of the view's size, see filters/backdrop_scale */
+        wf::dimensions_t get_backdrop_size(wlr_box view_box)
+        {
+            double scale = std::clamp<double>(self->backdrop_scale, 0.1, 1.0);
+            return {std::max(1, (int)std::round(view_box.width * scale)),
+                std::max(1, (int)std::round(view_box.height * scale))};
+        }
+
+        /*
+         * Filter what is behind the view into @out, unless it is still
+         * there from an earlier frame. It is read back from @target, where
+         * everything behind the view has been drawn by now. Parts of the
+         * target which this frame does not redraw still hold the view
+         * itself, so reading back waits for a frame redrawing all of it.
+         * Returns whether @out holds a filtered backdrop.
+         */
+        bool update_backdrop(const wf::render_target_t& target, wlr_box view_box,
+            wf::auxilliary_buffer_t& out, bool cached)
+        {
+            auto size = get_backdrop_size(view_box);
+            float progress = *self->fade;
+            bool dirty = !cached || !backdrop_valid || (backdrop_serial != self->backdrop_serial) ||
+                (backdrop_progress != progress) || (backdrop_uniforms_serial != self->uniforms_serial) ||
+                self->chain->time_dependent();
+            if (out.allocate(size, 1.0) != wf::buffer_reallocation_result_t::SAME)
+            {
+                dirty = true;
+                backdrop_valid = false;
+            }
+
+            if (!dirty)
+            {
+                return true;
+            }
+
+            if (!self->backdrop_fresh)
+            {
+                /* Keep the old backdrop for now and have everything behind the view redrawn */
+                self->backdrop_stale = true;
+                self->frames->frame_drawn(0.0, self->output);
+                return cached && backdrop_valid;
+            }
+
+            /* Read back the framebuffer under the view, scaled down on the way */
+            auto input = self->buffers->acquire(size);
+            GL_CALL(glDisable(GL_SCISSOR_TEST));
+            GL_CALL(glBindFramebuffer(GL_DRAW_FRAMEBUFFER,
+                wf::gles::ensure_render_buffer_fb_id(input->get_renderbuffer())));
+            GL_CALL(glClearColor(0.0, 0.0, 0.0, 0.0));
+            GL_CALL(glClear(GL_COLOR_BUFFER_BIT));
+            GL_CALL(glBindFramebuffer(GL_READ_FRAMEBUFFER, wf::gles::ensure_render_buffer_fb_id(target)));
+            GL_CALL(glBlitFramebuffer(view_box.x, view_box.y, view_box.x + view_box.width,
+                view_box.y + view_box.height, 0, 0, size.width, size.height, GL_COLOR_BUFFER_BIT, GL_LINEAR));
+            GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+            run_filter_chain(*self->chain, wf::gles_texture_t::from_aux(*input), size, *self->buffers.get(),
+                [&] (filter_program_t *program, const wf::gles_texture_t& texture,
+                     wf::auxilliary_buffer_t *buffer, const uniform_setter_t& uniforms, int)
+            {
+                wf::render_target_t pass_target{buffer ? *buffer : out};
+                pass_target.geometry = {0, 0, size.width, size.height};
+                draw(program, texture, pass_target, pass_target.geometry, progress, {}, nullptr, uniforms);
+            });
+            self->buffers->release(std::move(input));
+
+            backdrop_valid    = cached;
+            backdrop_progress = progress;
+            backdrop_serial   = self->backdrop_serial;
+            backdrop_uniforms_serial = self->uniforms_serial;
+            if (self->chain->time_dependent())
+            {
+                self->frames->frame_drawn(self->chain->max_fps(), self->output);
+            }
+
+            return true;
+        }
+
+        /*
+         * Draw the filtered backdrop @texture back where it was read from,
+         * scaled up bilinearly. Unlike the view's texture, it is in the
+         * orientation of the framebuffer, so no output transform applies.
+         */
+        void draw_backdrop(const wf::gles_texture_t& texture, const wf::render_target_t& target,
+            wlr_box view_box, const wf::regionf_t& damage)
+        {
+            auto program = self->passthrough.get();
+            program->program.use(program->type);
+            if (stats)
+            {
+                stats->count_bind();
+            }
+
+            bind_quad(program, false);
+            set_uniform(program, "mvp", glm::mat4(1.0));
+            set_uniform(program, "progress", 1.0f);
+            set_uniform(program, "in_tex", 0.0f);
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            program->program.set_active_texture(texture);
+            use_bilinear_sampling(program);
+            wf::gles::bind_render_buffer(target);
+            GL_CALL(glViewport(view_box.x, view_box.y, view_box.width, view_box.height));
+            GL_CALL(glDisable(GL_BLEND));
+            for (const auto& box : damage)
+            {
+                wf::gles::render_target_logic_scissor(target, box);
+                GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                if (stats)
+                {
+                    stats->count_draw(true);
+                }
+            }
+
+            end_draw(program);
+        }
+
+        /*
+         * In backdrop mode the chain filters what is behind the view, and
+         * the view is drawn on top of the result as it is.
+         */
+        void render_backdrop(wf::render_pass_t *pass, const wf::render_target_t& target,
+            const wf::regionf_t& damage)
+        {
+            auto view_box = get_view_box(target);
+            auto backdrop_damage = damage & get_backdrop_box();
+            auto src_tex = wf::gles_texture_t{get_texture(1.0)};
+            pass->custom_gles_subpass(target, [&]
+            {
+                stats = update_stats(self->stats, self->collect_stats);
+                if (stats)
+                {
+                    stats->begin_frame();
+                }
+
+                /* Without room in the memory budget, the backdrop is filtered on every frame */
+                bool cached = !memory_entry.evicted;
+                std::unique_ptr<wf::auxilliary_buffer_t> uncached;
+                if (!cached)
+                {
+                    uncached = self->buffers->acquire(get_backdrop_size(view_box));
+                }
+
+                auto& out = cached ? backdrop : *uncached;
+                if (update_backdrop(target, view_box, out, cached))
+                {
+                    draw_backdrop(wf::gles_texture_t::from_aux(out), target, view_box, backdrop_damage);
+                }
+
+                self->buffers->release(std::move(uncached));
+                draw(self->passthrough.get(), src_tex, target, view_box, 1.0, {}, &damage);
+                if (stats)
+                {
+                    stats->end_frame();
+                }
+            });
+            account_memory();
+        }
+
+        /*
+         * Blit the cached results of @members, back to front, with the
+         * passthrough program bound and the blend state set up only once.
+         * Only the textures and viewports change between the views.
+         */
+        void draw_batch(const std::vector<batch_member_t>& members, const wf::render_target_t& target)
+        {
+            auto program = self->passthrough.get();
+            program->program.use(program->type);
+            if (stats)
+            {
+                stats->count_bind();
+            }
+
+            bind_quad(program, false);
+            set_uniform(program, "mvp", wf::gles::output_transform(target));
+            set_uniform(program, "progress", 1.0f);
+            set_uniform(program, "in_tex", 0.0f);
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            wf::gles::bind_render_buffer(target);
+            GL_CALL(glEnable(GL_BLEND));
+            GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+
+            for (auto& member : members)
+            {
+                auto view_box = member.instance->get_view_box(target);
+                program->program.set_active_texture(wf::gles_texture_t::from_aux(member.instance->cache));
+                GL_CALL(glViewport(view_box.x, view_box.y, view_box.width, view_box.height));
+                for (const auto& box : member.damage)
+                {
+                    wf::gles::render_target_logic_scissor(target, box);
+                    GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                    if (member.instance->stats)
+                    {
+                        member.instance->stats->count_draw(true);
+                    }
+                }
+            }
+
+            /* Disable stuff */
+            GL_CALL(glDisable(GL_BLEND));
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+            GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+            GL_CALL(glBindVertexArray(0));
+
+            program->program.deactivate();
+        }
+
+        void render(const wf::scene::render_instruction_t& data)
+        {
+            /* Backdrop views never batch, see can_batch_with() */
+            if (self->chain->backdrop && self->passthrough)
+            {
+                render_backdrop(data.pass, data.target, data.damage);
+                return;
+            }
+
+            /* Back to front, this view is in front of its batch */
+            std::vector<batch_member_t> members(batch.rbegin(), batch.rend());
+            members.push_back({this, data.damage});
+            batch.clear();
+
+            bool cached = std::all_of(members.begin(), members.end(), [] (const batch_member_t& member)
+            {
+                return member.instance->use_cache();
+            });
+            if (!cached)
+            {
+                for (auto& member : members)
+                {
+                    member.instance->render_single(data.pass, data.target, member.damage);
+                }
+
+                return;
+            }
+
+            /* get_texture() consumes the damage of the children, and may render them */
+            std::vector<wf::gles_texture_t> textures;
+            std::vector<bool> content_damaged;
+            for (auto& member : members)
+            {
+                content_damaged.push_back(!member.instance->cached_damage.empty());
+                textures.push_back(wf::gles_texture_t{member.instance->get_texture(1.0)});
+            }
+
+            data.pass->custom_gles_subpass(data.target, [&]
+            {
+                /* Timer queries cannot nest, the shared blit is accounted to this view */
+                for (size_t i = 0; i < members.size(); i++)
+                {
+                    auto instance = members[i].instance;
+                    instance->stats = update_stats(instance->self->stats, instance->self->collect_stats);
+                    if (instance->stats)
+                    {
+                        instance->stats->begin_frame();
+                    }
+
+                    instance->update_cache(textures[i], content_damaged[i]);
+                    if (instance->stats && (instance != this))
+                    {
+                        instance->stats->end_frame();
+                    }
+                }
+
+                draw_batch(members, data.target);
+                if (stats)
+                {
+                    stats->end_frame();
+                }
+            });
+
+            for (auto& member : members)
+            {
+                member.instance->account_memory();
+            }
+        }
+    };
+
+    wf_filters(wayfire_view view, std::shared_ptr<filter_chain_t> chain) :
+        wf::scene::view_2d_transformer_t(view)
+    {
+        this->view    = view;
+        this->view_id = view->get_id();
+        this->chain   = chain;
+        this->output  = view->get_output();
+        this->passthrough = programs->acquire(passthrough_fragment_shader);
+        this->frames = std::make_unique<frame_scheduler_t>(
+            [=] { damage_node(shared_from_this(), get_bounding_box()); });
+
+        fade = std::make_unique<wf::animation::simple_animation_t>(wf::create_option<int>(700));
+        fade->set(0.0, 0.0);
+        fade->animate(1.0);
+        set_pre_hook();
+        if (chain->backdrop && output)
+        {
+            output->render->add_effect(&backdrop_hook, wf::OUTPUT_EFFECT_DAMAGE);
+            backdrop_hook_set = true;
+        }
+
+        send_event("filters/applied");
+    }
+
+    void unapply()
+    {
+        if (!unapplied())
+        {
+            send_event("filters/fade-out-started");
+        }
+
+        fade->animate(0.0);
+        set_pre_hook();
+    }
+
+    /* Whether the filter is fading out to be removed */
+    bool unapplied()
+    {
+        return fade->end == 0.0;
+    }
+
+    /* Switch to @stages built from new sources, without fading in again */
+    void reload(const std::vector<filter_stage_t>& stages)
+    {
+        replace_stages(*chain, stages);
+        if (!programs->specialize(*chain))
+        {
+            LOGE("Failed to compile specialized shader.");
+        }
+
+        uniforms_serial++;
+        damage_node(shared_from_this(), get_bounding_box());
+    }
+
+    /* Takes effect on the next frame, see set_chain_uniforms() */
+    std::string set_uniforms(const wf::json_t& uniforms)
+    {
+        auto error = set_chain_uniforms(*chain, uniforms);
+        if (error.empty() && !programs->specialize(*chain))
+        {
+            error = "Failed to compile specialized shader";
+        }
+
+        if (error.empty())
+        {
+            uniforms_serial++;
+            damage_node(shared_from_this(), get_bounding_box());
+        }
+
+        return error;
+    }
+
+    /*
+     * Whether the filtered result may be cached between frames. Shaders
+     * reading gl_FragCoord depend on where they are drawn and opt out.
+     */
+    bool use_cache()
+    {
+        return cache_results && chain->cacheable() && passthrough;
+    }
+
+    /* The pre hook only runs while the fade is in progress */
+    void set_pre_hook()
+    {
+        if (output && !pre_hook_set)
+        {
+            output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+            pre_hook_set = true;
+        }
+    }
+
+    void unset_pre_hook()
+    {
+        if (output && pre_hook_set)
+        {
+            output->render->rem_effect(&pre_hook);
+            pre_hook_set = false;
+        }
+    }
+
+    void pop_transformer(wayfire_view view)
+    {
+        if (view->get_transformed_node()->get_transformer(transformer_name))
+        {
+            LOGI("Removing shader and transformer.");
+            view->get_transformed_node()->rem_transformer(transformer_name);
+        }
+    }
+
+    wf::effect_hook_t pre_hook = [=] ()
+    {
+        /* Damage one more frame after the fade ends, so its final state is shown */
+        damage_node(shared_from_this(), get_bounding_box());
+        if (fade->running())
+        {
+            return;
+        }
+
+        unset_pre_hook();
+        if (fade->end == 0.0)
+        {
+            pop_transformer(view);
+        } else
+        {
+            send_event("filters/fade-in-done");
+        }
+    };
+
+    /*
+     * In backdrop mode, have the backdrop filtered again only if this
+     * frame damages something behind the view, not just the view itself.
+     * The whole box is then damaged, so that the nodes behind the view
+     * redraw all of it before it is read back, see update_backdrop().
+     */
+    wf::effect_hook_t backdrop_hook = [=] ()
+    {
+        auto bbox   = get_bounding_box();
+        auto damage = output->render->get_scheduled_damage();
+        auto behind = damage & bbox;
+        if (!backdrop_uncached)
+        {
+            behind ^= own_damage;
+        }
+
+        if (!behind.empty() || backdrop_stale)
+        {
+            backdrop_serial++;
+            backdrop_stale = false;
+            output->render->damage(bbox);
+            damage |= bbox;
+        }
+
+        own_damage.clear();
+        backdrop_fresh = (wf::region_t{bbox} ^ damage).empty();
+    };
+
+    void gen_render_instances(std::vector<render_instance_uptr>& instances,
+        damage_callback push_damage, wf::output_t *shown_on) override
+    {
+        /* All damage of the view's surfaces and of this node passes through here */
+        auto push_own_damage = [=] (const auto& region)
+        {
+            if (chain && chain->backdrop)
+            {
+                own_damage |= region;
+            }
+
+            push_damage(region);
+        };
+        instances.push_back(std::make_unique<simple_node_render_instance_t>(
+            this, push_own_damage, view));
+    }
+
+    virtual ~wf_filters()
+    {
+        send_event("filters/removed");
+        if (backdrop_hook_set)
+        {
+            output->render->rem_effect(&backdrop_hook);
+        }
+
+        chain.reset();
+        passthrough.reset();
+        fade.reset();
+        unset_pre_hook();
+    }
+};
+
+class wayfire_per_output_filters : public wf::per_output_plugin_instance_t
+{
+    wf::shared_data::ref_ptr_t<program_cache_t> programs;
+    wf::shared_data::ref_ptr_t<buffer_pool_t> buffers;
+    wf::shared_data::ref_ptr_t<filter_events_t> events;
+    std::unique_ptr<wf::animation::simple_animation_t> fade;
+    std::shared_ptr<filter_chain_t> chain = nullptr;
+    std::shared_ptr<filter_program_t> passthrough;
+    wf::option_wrapper_t<bool> cache_results{"filters/cache_results"};
+    wf::option_wrapper_t<bool> collect_stats{"filters/stats"};
+    wf::option_wrapper_t<double> scale_option{"filters/fs_scale"};
+    /* Set over IPC, overrides filters/fs_scale */
+    std::optional<double> scale_override;
+    /* Only while filters/stats is enabled */
+    std::unique_ptr<filter_stats_t> stats;
+    /* Drives the time uniform and redraws time dependent chains */
+    std::unique_ptr<frame_scheduler_t> frames;
+    /* Registered while the output has a filter */
+    wf::shared_data::ref_ptr_t<memory_tracker_t> memory;
+    memory_tracker_t::entry_t memory_entry;
+    wf::post_hook_t hook;
+    bool active = false;
+    bool pre_hook_set = false;
+
+    /*
+     * The filtered frame, of which only the damaged parts are filtered
+     * again. It is smaller than the output when filtering at reduced scale.
+     */
+    wf::auxilliary_buffer_t result;
+    bool result_valid = false;
+    float result_progress;
+    /* The damage of the frame being rendered, in output-local coordinates */
+    wf::region_t frame_damage;
+
+    /* The pre hook only runs while the fade is in progress */
+    void set_pre_hook()
+    {
+        if (!pre_hook_set)
+        {
+            output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+            pre_hook_set = true;
+        }
+    }
+
+    void unset_pre_hook()
+    {
+        if (pre_hook_set)
+        {
+            output->render->rem_effect(&pre_hook);
+            pre_hook_set = false;
+        }
+    }
+
+  public:
+    void init() override
+    {
+        hook = [=] (wf::auxilliary_buffer_t& aux_buf, const wf::render_buffer_t& render_buf)
+        {
+            render(aux_buf, render_buf);
+        };
+        fade = std::make_unique<wf::animation::simple_animation_t>(wf::create_option<int>(700));
+        fade->set(0.0, 0.0);
+        passthrough = programs->acquire(passthrough_fragment_shader);
+        frames = std::make_unique<frame_scheduler_t>([=] { output->render->damage_whole(); });
+        memory_entry.owner["output-name"] = output->to_string();
+        memory_entry.evict = [=]
+        {
+            wf::gles::run_in_context([&] { result.free(); });
+            result_valid = false;
+        };
+    }
+
+    wf::effect_hook_t pre_hook = [=] ()
+    {
+        output->render->damage_whole();
+        if (fade->running())
+        {
+            return;
+        }
+
+        unset_pre_hook();
+        if (fade->end == 0.0)
+        {
+            send_event("filters/removed", chain->passes);
+            output->render->rem_post(&hook);
+            output->render->rem_effect(&damage_hook);
+            memory->remove(&memory_entry);
+            wf::gles::run_in_context([&] { result.free(); });
+            result_valid = false;
+            chain  = nullptr;
+            active = false;
+        } else
+        {
+            send_event("filters/fade-in-done", chain->passes);
+        }
+    };
+
+    void send_event(std::string name, const std::vector<filter_pass_t>& passes, std::string error = "")
+    {
+        wf::json_t event;
+        event["output-name"] = output->to_string();
+        if (!error.empty())
+        {
+            event["error"] = error;
+        }
+
+        events->send(name, event, passes);
+    }
+
+    /* Runs once the damage of the frame is known, before the post hook */
+    wf::effect_hook_t damage_hook = [=] ()
+    {
+        frame_damage = output->render->get_scheduled_damage();
+    };
+
+    wf::json_t set_fs_shader(std::vector<filter_pass_t> passes)
+    {
+        if (!load_shader_sources(passes))
+        {
+            LOGE("Failed to read fullscreen shader.");
+            send_event("filters/compile-failed", passes, "Failed to read fullscreen shader.");
+            return wf::ipc::json_error("Failed to read fullscreen shader.");
+        }
+
+        program_cache_result_t cache_result;
+        auto new_chain = programs->acquire_chain(passes, &cache_result);
+        if (!new_chain)
+        {
+            LOGE("Failed to compile fullscreen shader.");
+            send_event("filters/compile-failed", passes, "Failed to compile fullscreen shader.");
+            return wf::ipc::json_error("Failed to compile fullscreen shader.");
+        }
+
+        set_fs_shader(new_chain);
+
+        auto response = wf::ipc::json_ok();
+        response["program-cache"] = program_cache_result_to_string(cache_result);
+        return response;
+    }
+
+    void set_fs_shader(std::shared_ptr<filter_chain_t> new_chain)
+    {
+        if (active)
+        {
+            send_event("filters/removed", chain->passes);
+        }
+
+        chain = new_chain;
+        result_valid = false;
+        frames->restart();
+        output->render->damage_whole();
+
+        if (!active)
+        {
+            output->render->add_effect(&damage_hook, wf::OUTPUT_EFFECT_DAMAGE);
+            output->render->add_post(&hook);
+            memory->add(&memory_entry);
+            active = true;
+        }
+
+        /* Also fade back in if a fade out is in progress */
+        if (fade->end != 1.0)
+        {
+            fade->animate(1.0);
+            set_pre_hook();
+        }
+
+        LOGI("Successfully compiled and applied fullscreen shader to output: ", output->to_string());
+        send_event("filters/applied", chain->passes);
+    }
+
+    /* Takes effect on the next frame, see set_chain_uniforms() */
+    wf::json_t set_uniforms(const wf::json_t& uniforms)
+    {
+        if (!chain)
+        {
+            return wf::ipc::json_error("Output has no shader");
+        }
+
+        auto error = set_chain_uniforms(*chain, uniforms);
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        if (!programs->specialize(*chain))
+        {
+            return wf::ipc::json_error("Failed to compile specialized shader");
+        }
+
+        result_valid = false;
+        output->render->damage_whole();
+        return wf::ipc::json_ok();
+    }
+
+    /* The chain while the output has a filter, even if it is fading out */
+    std::shared_ptr<filter_chain_t> get_chain()
+    {
+        return active ? chain : nullptr;
+    }
+
+    /* Switch to @stages built from new sources, without fading in again */
+    void reload(const std::vector<filter_stage_t>& stages)
+    {
+        replace_stages(*chain, stages);
+        if (!programs->specialize(*chain))
+        {
+            LOGE("Failed to compile specialized shader.");
+        }
+
+        result_valid = false;
+        output->render->damage_whole();
+    }
+
+    wf::json_t unset_fs_shader()
+    {
+        if (active && (fade->end != 0.0))
+        {
+            send_event("filters/fade-out-started", chain->passes);
+        }
+
+        if (active)
+        {
+            fade->animate(0.0);
+            set_pre_hook();
+        }
+
+        return wf::ipc::json_ok();
+    }
+
+    wf::json_t fs_has_shader()
+    {
+        auto response = wf::ipc::json_ok();
+        response["has-shader"] = active;
+        response["fading-out"] = active && (fade->end == 0.0);
+        return response;
+    }
+
+    /* The output's wf/filters/stats entry, if stats were collected */
+    std::optional<wf::json_t> stats_to_json()
+    {
+        if (!active || !stats)
+        {
+            return {};
+        }
+
+        wf::json_t entry;
+        entry["output-name"] = output->to_string();
+        entry["shader-path"] = pass_list_to_json(chain->passes);
+        entry["stats"] = stats->to_json();
+        return entry;
+    }
+
+    /* The output's wf/filters/list entry, if it has a shader */
+    std::optional<wf::json_t> describe()
+    {
+        if (!active || (fade->end == 0.0))
+        {
+            return {};
+        }
+
+        wf::json_t entry;
+        entry["output-name"] = output->to_string();
+        entry["shader-path"] = pass_list_to_json(chain->passes);
+        entry["scale"] = get_scale();
+        return entry;
+    }
+
+    /* Unset @scale to follow filters/fs_scale again */
+    wf::json_t set_scale(std::optional<double> scale)
+    {
+        scale_override = scale;
+        output->render->damage_whole();
+        auto response = wf::ipc::json_ok();
+        response["scale"] = scale.value_or(scale_option);
+        return response;
+    }
+
+    /*
+     * The scale the chain runs at. Pointwise chains gain nothing from a
+     * smaller buffer and always run at full resolution, as do chains
+     * without a passthrough program to scale the result back up.
+     */
+    double get_scale()
+    {
+        if (!chain || !passthrough || (chain->sampling_radius() == 0.0))
+        {
+            return 1.0;
+        }
+
+        return std::clamp<double>(scale_override.value_or(scale_option), 0.1, 1.0);
+    }
+
+    /*
+     * Draw @texture with @program over @target. Drawing to the output's
+     * buffer flips the texture and blends, drawing between aux buffers
+     * keeps their orientation. If @scissor is given, only its boxes are
+     * drawn, in GL coordinates of the target.
+     */
+    void draw(filter_program_t *program, const wf::gles_texture_t& texture,
+        const wf::render_buffer_t& target, wf::dimensions_t size, bool to_output,
+        const std::vector<wlr_box> *scissor, const uniform_setter_t& uniforms = {})
+    {
+        /* Upload data to shader */
+        program->program.use(wf::TEXTURE_TYPE_RGBA);
+        if (stats)
+        {
+            stats->count_bind();
+        }
+
+        bind_quad(program, to_output);
+        set_uniform(program, "mvp", glm::mat4(1.0));
+        set_uniform(program, "progress", *fade);
+        set_uniform(program, "in_tex", 0.0f);
+        set_uniform(program, "time", frames->get_time());
+        GL_CALL(glActiveTexture(GL_TEXTURE0));
+        program->program.set_active_texture(texture);
+        if (uniforms)
+        {
+            uniforms(program);
+        }
+
+        /* Render it to target */
+        wf::gles::bind_render_buffer(target);
+        GL_CALL(glViewport(0, 0, size.width, size.height));
+
+        if (to_output)
+        {
+            GL_CALL(glEnable(GL_BLEND));
+            GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+        }
+
+        if (scissor)
+        {
+            GL_CALL(glEnable(GL_SCISSOR_TEST));
+            for (auto& box : *scissor)
+            {
+                GL_CALL(glScissor(box.x, box.y, box.width, box.height));
+                GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                if (stats)
+                {
+                    stats->count_draw(true);
+                }
+            }
+        } else
+        {
+            GL_CALL(glDisable(GL_SCISSOR_TEST));
+            GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+            if (stats)
+            {
+                stats->count_draw(false);
+            }
+        }
+
+        /* Disable stuff */
+        GL_CALL(glDisable(GL_SCISSOR_TEST));
+        GL_CALL(glDisable(GL_BLEND));
+        GL_CALL(glActiveTexture(GL_TEXTURE0));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+        GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+        GL_CALL(glBindVertexArray(0));
+
+        program->program.deactivate();
+    }
+
+    /*
+     * The boxes of this frame's damage, grown by @padding pixels, in GL
+     * coordinates of an aux buffer of the output's @size.
+     */
+    std::vector<wlr_box> damage_boxes(wf::dimensions_t size, float padding)
+    {
+        auto target = output->render->get_target_framebuffer();
+        int pad     = std::ceil(padding);
+        wlr_box bounds = {0, 0, size.width, size.height};
+
+        std::vector<wlr_box> boxes;
+        for (const auto& rect : frame_damage)
+        {
+            auto box = target.framebuffer_box_from_geometry_box(wlr_box_from_pixman_box(rect));
+            box.x     -= pad;
+            box.y     -= pad;
+            box.width += 2 * pad;
+            box.height += 2 * pad;
+
+            wlr_box clipped;
+            if (wlr_box_intersection(&clipped, &box, &bounds))
+            {
+                clipped.y = size.height - clipped.y - clipped.height;
+                boxes.push_back(clipped);
+            }
+        }
+
+        return boxes;
+    }
+
+    /*
+     * The chain draws into the result buffer, which is then copied to the
+     * output. While the filter parameters stay the same, only the parts of
+     * the result around this frame's damage are filtered again. At reduced
+     * scale, the frame is first scaled down into a pooled buffer, the chain
+     * runs at that size and its result is scaled back up bilinearly.
+     */
+    void render(wf::auxilliary_buffer_t& aux_buf, const wf::render_buffer_t& render_buf)
+    {
+        auto size = aux_buf.get_size();
+        float progress = *fade;
+        double scale   = get_scale();
+        bool scaled    = scale < 1.0;
+        auto filter_size = size;
+        if (scaled)
+        {
+            filter_size.width  = std::max(1, (int)std::round(size.width * scale));
+            filter_size.height = std::max(1, (int)std::round(size.height * scale));
+        }
+
+        wf::gles::run_in_context([&]
+        {
+            if (update_stats(stats, collect_stats))
+            {
+                stats->begin_frame();
+            }
+
+            /* Without room for the result in the memory budget, filter straight into the output */
+            float radius = chain->sampling_radius();
+            bool direct  = !passthrough || !memory->readmit(&memory_entry, buffer_bytes(filter_size));
+            bool full    = direct || !cache_results || !result_valid ||
+                (result_progress != progress) || (radius < 0.0) || chain->time_dependent();
+            if (!direct && (result.allocate(filter_size, 1.0) != wf::buffer_reallocation_result_t::SAME))
+            {
+                full = true;
+            }
+
+            /* Damage is not tracked at reduced scale, any damage filters the whole frame */
+            if (scaled && !frame_damage.empty())
+            {
+                full = true;
+            }
+
+            /* Each stage must be correct wherever the stages after it read */
+            std::vector<std::vector<wlr_box>> stage_boxes(chain->stages.size());
+            if (!full)
+            {
+                float padding = radius;
+                for (size_t i = chain->stages.size(); i-- > 0;)
+                {
+                    stage_boxes[i] = damage_boxes(size, padding);
+                    padding += chain->stages[i].get_sampling_radius();
+                }
+            }
+
+            if (full || !stage_boxes.back().empty())
+            {
+                auto input = wf::gles_texture_t::from_aux(aux_buf);
+                std::unique_ptr<wf::auxilliary_buffer_t> downscaled;
+                if (scaled)
+                {
+                    downscaled = buffers->acquire(filter_size);
+                    draw(passthrough.get(), input, downscaled->get_renderbuffer(), filter_size, false,
+                        nullptr, use_bilinear_sampling);
+                    input = wf::gles_texture_t::from_aux(*downscaled);
+                }
+
+                run_filter_chain(*chain, input, filter_size, *buffers.get(),
+                    [&] (filter_program_t *program, const wf::gles_texture_t& texture,
+                         wf::auxilliary_buffer_t *buffer, const uniform_setter_t& uniforms, int stage)
+                {
+                    if (!buffer && direct)
+                    {
+                        draw(program, texture, render_buf, size, true, nullptr, uniforms);
+                        return;
+                    }
+
+                    auto& target = buffer ? *buffer : result;
+                    auto scissor = (full || (stage < 0)) ? nullptr : &stage_boxes[stage];
+                    draw(program, texture, target.get_renderbuffer(), target.get_size(), false,
+                        scissor, uniforms);
+                });
+                buffers->release(std::move(downscaled));
+                result_valid    = !direct;
+                result_progress = progress;
+            }
+
+            if (!direct)
+            {
+                draw(passthrough.get(), wf::gles_texture_t::from_aux(result), render_buf, size, true,
+                    nullptr, scaled ? use_bilinear_sampling : uniform_setter_t{});
+            }
+
+            if (stats)
+            {
+                stats->end_frame();
+            }
+        });
+        frame_damage.clear();
+        memory_entry.cache_bytes = buffer_bytes(result.get_size());
+        memory->touch(&memory_entry, *chain);
+
+        if (chain->time_dependent())
+        {
+            frames->frame_drawn(chain->max_fps(), output);
+        }
+    }
+
+    void fini() override
+    {
+        unset_pre_hook();
+        output->render->rem_post(&hook);
+        output->render->rem_effect(&damage_hook);
+        output->render->damage_whole();
+        memory->remove(&memory_entry);
+        chain = nullptr;
+        passthrough.reset();
+        fade.reset();
+        stats.reset();
+        frames.reset();
+    }
+};
+
+class wayfire_filters : public wf::plugin_interface_t,
+    public wf::per_output_tracker_mixin_t<wayfire_per_output_filters>
+{
+    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> ipc_repo;
+    wf::shared_data::ref_ptr_t<program_cache_t> programs;
+    wf::shared_data::ref_ptr_t<buffer_pool_t> buffers;
+    wf::shared_data::ref_ptr_t<filter_events_t> events;
+    wf::shared_data::ref_ptr_t<memory_tracker_t> memory;
+    wf::option_wrapper_t<bool> collect_stats{"filters/stats"};
+    wf::option_wrapper_t<bool> hot_reload{"filters/hot_reload"};
+    std::unique_ptr<shader_loader_t> loader;
+    /* Only while filters/hot_reload is enabled */
+    std::unique_ptr<shader_watcher_t> watcher;
+    /* Loader jobs recompiling filters whose files changed, see reload_shaders() */
+    std::set<uint64_t> reload_tokens;
+
+    /* An asynchronous set-view-shader or set-fs-shader request in flight */
+    struct async_request_t
+    {
+        wf::ipc::client_interface_t *client;
+        /* Either a view or an output, as given in the request */
+        uint64_t view_id;
+        std::string output_name;
+        bool backdrop = false;
+    };
+
+    uint64_t next_token = 1;
+    std::map<uint64_t, async_request_t> async_requests;
+
+    /* Rules set over IPC are matched before those from the config */
+    wf::option_wrapper_t<wf::config::compound_list_t<std::string, std::string>> rules_option{"filters/rules"};
+    std::vector<std::shared_ptr<filter_rule_t>> config_rules;
+    std::vector<std::shared_ptr<filter_rule_t>> ipc_rules;
+
+    void pop_transformer(wayfire_view view)
+    {
+        if (view->get_transformed_node()->get_transformer(transformer_name))
+        {
+            LOGI("Removing shader and transformer.");
+            view->get_transformed_node()->rem_transformer(transformer_name);
+        }
+    }
+
+    void remove_transformers()
+    {
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            pop_transformer(view);
+        }
+    }
+
+  public:
+    void init() override
+    {
+        loader = std::make_unique<shader_loader_t>(programs.get(), [=] (shader_loader_t::job_t& job)
+        {
+            if (reload_tokens.erase(job.token))
+            {
+                finish_reload(job);
+            } else
+            {
+                finish_async_request(job);
+            }
+        });
+        ipc_repo->connect(&on_client_disconnected);
+        ipc_repo->register_method("wf/filters/set-view-shader", ipc_set_view_shader);
+        ipc_repo->register_method("wf/filters/unset-view-shader", ipc_unset_view_shader);
+        ipc_repo->register_method("wf/filters/view-has-shader", ipc_view_has_shader);
+        ipc_repo->register_method("wf/filters/set-fs-shader", ipc_set_fs_shader);
+        ipc_repo->register_method("wf/filters/unset-fs-shader", ipc_unset_fs_shader);
+        ipc_repo->register_method("wf/filters/fs-has-shader", ipc_fs_has_shader);
+        ipc_repo->register_method("wf/filters/set-fs-scale", ipc_set_fs_scale);
+        ipc_repo->register_method("wf/filters/set-uniforms", ipc_set_uniforms);
+        ipc_repo->register_method("wf/filters/set-max-fps", ipc_set_max_fps);
+        ipc_repo->register_method("wf/filters/set-rules", ipc_set_rules);
+        ipc_repo->register_method("wf/filters/list", ipc_list);
+        ipc_repo->register_method("wf/filters/watch", ipc_watch);
+        ipc_repo->register_method("wf/filters/stats", ipc_stats);
+        ipc_repo->register_method("wf/filters/memory", ipc_memory);
+        ipc_repo->register_method("wf/filters/bake-lut", ipc_bake_lut);
+
+        per_output_tracker_mixin_t::init_output_tracking();
+
+        wf::get_core().connect(&on_view_mapped);
+        wf::get_core().connect(&on_view_set_output);
+        wf::get_core().connect(&on_view_tiled);
+        wf::get_core().connect(&on_view_fullscreen);
+        wf::get_core().connect(&on_view_activated);
+        wf::get_core().connect(&on_title_changed);
+        wf::get_core().connect(&on_app_id_changed);
+        rules_option.set_callback([=] { load_config_rules(); });
+        hot_reload.set_callback([=] { update_watches(); });
+        load_config_rules();
+    }
+
+    void handle_new_output(wf::output_t *output) override
+    {
+        per_output_tracker_mixin_t::handle_new_output(output);
+    }
+
+    void handle_output_removed(wf::output_t *output) override
+    {
+        per_output_tracker_mixin_t::handle_output_removed(output);
+    }
+
+    std::shared_ptr<wf_filters> ensure_transformer(wayfire_view view, std::shared_ptr<filter_chain_t> chain)
+    {
+        auto tmgr = view->get_transformed_node();
+        if (tmgr->get_transformer<wf_filters>(transformer_name))
+        {
+            view->get_transformed_node()->rem_transformer(transformer_name);
+        }
+
+        auto node = std::make_shared<wf_filters>(view, chain);
+        tmgr->add_transformer(node, wf::TRANSFORMER_2D, transformer_name);
+        update_watches();
+
+        return tmgr->get_transformer<wf_filters>(transformer_name);
+    }
+
+    /* The passes of every distinct filter applied to a view or output, or set by a rule */
+    std::vector<std::vector<filter_pass_t>> passes_in_use()
+    {
+        std::vector<std::vector<filter_pass_t>> in_use;
+        auto add = [&] (const std::shared_ptr<filter_chain_t>& chain)
+        {
+            if (chain && std::none_of(in_use.begin(), in_use.end(),
+                [&] (const std::vector<filter_pass_t>& passes) { return same_passes(passes, chain->passes); }))
+            {
+                in_use.push_back(chain->passes);
+            }
+        };
+
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            if (auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name))
+            {
+                add(tr->chain);
+            }
+        }
+
+        for (auto& [output, instance] : output_instance)
+        {
+            add(instance->get_chain());
+        }
+
+        for (auto rules : {&ipc_rules, &config_rules})
+        {
+            for (auto& rule : *rules)
+            {
+                add(rule->chain);
+            }
+        }
+
+        return in_use;
+    }
+
+    /* Watch the files of every filter in use while filters/hot_reload is enabled */
+    void update_watches()
+    {
+        if (!hot_reload)
+        {
+            watcher.reset();
+            return;
+        }
+
+        if (!watcher)
+        {
+            watcher = std::make_unique<shader_watcher_t>(
+                [=] (const std::set<std::string>& paths) { reload_shaders(paths); });
+        }
+
+        std::set<std::string> paths;
+        for (auto& passes : passes_in_use())
+        {
+            for (auto& pass : passes)
+            {
+                if (!pass.blur)
+                {
+                    paths.insert(pass.path);
+                }
+            }
+        }
+
+        watcher->set_paths(paths);
+    }
+
+    /* Recompile every filter reading one of @paths in the background, see finish_reload() */
+    void reload_shaders(const std::set<std::string>& paths)
+    {
+        for (auto& passes : passes_in_use())
+        {
+            if (std::any_of(passes.begin(), passes.end(),
+                [&] (const filter_pass_t& pass) { return !pass.blur && paths.count(pass.path); }))
+            {
+                auto token = next_token++;
+                reload_tokens.insert(token);
+                loader->submit({token, passes, programs->use_binary_cache()});
+            }
+        }
+    }
+
+    /*
+     * Swap the recompiled programs into every view, output and rule using
+     * the filter. If they failed to compile, the old programs stay.
+     */
+    void finish_reload(shader_loader_t::job_t& job)
+    {
+        program_cache_result_t cache_result;
+        auto chain = job.read_ok ? chain_from_job(job, cache_result) : nullptr;
+        std::string error = job.read_ok ? "Failed to compile shader." : "Failed to read shader.";
+        if (!chain)
+        {
+            LOGE("Failed to reload shader: ", error);
+        }
+
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+            if (!tr || !same_passes(tr->chain->passes, job.passes))
+            {
+                continue;
+            }
+
+            if (chain)
+            {
+                tr->reload(chain->stages);
+            } else
+            {
+                send_compile_failed({nullptr, view->get_id(), ""}, job.passes, error);
+            }
+        }
+
+        for (auto& [output, instance] : output_instance)
+        {
+            auto output_chain = instance->get_chain();
+            if (!output_chain || !same_passes(output_chain->passes, job.passes))
+            {
+                continue;
+            }
+
+            if (chain)
+            {
+                instance->reload(chain->stages);
+            } else
+            {
+                send_compile_failed({nullptr, 0, output->to_string()}, job.passes, error);
+            }
+        }
+
+        for (auto rules : {&ipc_rules, &config_rules})
+        {
+            for (auto& rule : *rules)
+            {
+                if (chain && same_passes(rule->chain->passes, job.passes))
+                {
+                    replace_stages(*rule->chain, chain->stages);
+                }
+            }
+        }
+
+        if (chain)
+        {
+            LOGI("Reloaded shader, program cache ", program_cache_result_to_string(cache_result));
+        }
+    }
+
+    wf::json_t set_view_shader(wayfire_view view, std::shared_ptr<filter_chain_t> chain,
+        bool backdrop = false)
+    {
+        chain->backdrop = backdrop;
+        ensure_transformer(view, chain);
+        LOGI("Successfully compiled and applied shader.");
+        view->damage();
+        return wf::ipc::json_ok();
+    }
+
+    /*
+     * Drop in-flight asynchronous requests for the given target, a newer
+     * request or an unset overrides them.
+     */
+    void cancel_async_requests(uint64_t view_id, std::string output_name)
+    {
+        for (auto it = async_requests.begin(); it != async_requests.end();)
+        {
+            if ((it->second.view_id == view_id) && (it->second.output_name == output_name))
+            {
+                send_async_event(it->first, it->second, "filters/shader-failed",
+                    "Superseded by a later request.");
+                it = async_requests.erase(it);
+            } else
+            {
+                ++it;
+            }
+        }
+    }
+
+    wf::json_t submit_async_request(wf::ipc::client_interface_t *client,
+        uint64_t view_id, std::string output_name, std::vector<filter_pass_t> passes,
+        bool backdrop = false)
+    {
+        cancel_async_requests(view_id, output_name);
+
+        auto token = next_token++;
+        async_requests[token] = {client, view_id, output_name, backdrop};
+        loader->submit({token, passes, programs->use_binary_cache()});
+
+        auto response = wf::ipc::json_ok();
+        response["token"] = token;
+        return response;
+    }
+
+    /* Tell watchers that shaders for the target of @request failed to load */
+    void send_compile_failed(const async_request_t& request, const std::vector<filter_pass_t>& passes,
+        std::string error)
+    {
+        wf::json_t event;
+        if (request.output_name.empty())
+        {
+            event["view-id"] = request.view_id;
+        } else
+        {
+            event["output-name"] = request.output_name;
+        }
+
+        event["error"] = error;
+        events->send("filters/compile-failed", event, passes);
+    }
+
+    void send_async_event(uint64_t token, const async_request_t& request,
+        std::string event_name, std::string error = "")
+    {
+        if (!request.client)
+        {
+            return;
+        }
+
+        wf::json_t event;
+        event["event"] = event_name;
+        event["token"] = token;
+        if (request.output_name.empty())
+        {
+            event["view-id"] = request.view_id;
+        } else
+        {
+            event["output-name"] = request.output_name;
+        }
+
+        if (!error.empty())
+        {
+            event["error"] = error;
+        }
+
+        request.client->send_json(event);
+    }
+
+    /* The chain of a loader job whose sources were read, nullptr if it failed to link */
+    std::shared_ptr<filter_chain_t> chain_from_job(shader_loader_t::job_t& job,
+        program_cache_result_t& cache_result)
+    {
+        cache_result = PROGRAM_CACHE_SHARED;
+        if (!job.linked)
+        {
+            return programs->acquire_chain(job.passes, &cache_result);
+        }
+
+        /* Linked on the loader thread */
+        if (!job.link_ok)
+        {
+            return nullptr;
+        }
+
+        auto chain = std::make_shared<filter_chain_t>();
+        chain->stages = job.stages;
+        chain->set_passes(job.passes);
+        for (auto& stage : chain->stages)
+        {
+            for (auto& shader : stage.programs)
+            {
+                auto adopted = programs->adopt(shader);
+                if (adopted == shader)
+                {
+                    cache_result = job.binary_hit ? PROGRAM_CACHE_DISK_HIT : PROGRAM_CACHE_MISS;
+                }
+
+                shader = adopted;
+            }
+        }
+
+        return chain;
+    }
+
+    void finish_async_request(shader_loader_t::job_t& job)
+    {
+        auto it = async_requests.find(job.token);
+        if (it == async_requests.end())
+        {
+            return;
+        }
+
+        auto request = it->second;
+        async_requests.erase(it);
+        if (!job.read_ok)
+        {
+            LOGE("Failed to read shader.");
+            send_compile_failed(request, job.passes, "Failed to read shader.");
+            send_async_event(job.token, request, "filters/shader-failed", "Failed to read shader.");
+            return;
+        }
+
+        program_cache_result_t cache_result;
+        auto chain = chain_from_job(job, cache_result);
+        if (!chain)
+        {
+            LOGE("Failed to compile shader.");
+            send_compile_failed(request, job.passes, "Failed to compile shader.");
+            send_async_event(job.token, request, "filters/shader-failed", "Failed to compile shader.");
+            return;
+        }
+
+        if (request.output_name.empty())
+        {
+            auto view = wf::ipc::find_view_by_id(request.view_id);
+            if (!view)
+            {
+                send_async_event(job.token, request, "filters/shader-failed",
+                    "Failed to find view with given id. Maybe it isn't mapped?");
+                return;
+            }
+
+            set_view_shader(view, chain, request.backdrop);
+        } else
+        {
+            auto output = find_output_by_name(request.output_name);
+            if (!output)
+            {
+                send_async_event(job.token, request, "filters/shader-failed", "No such output");
+                return;
+            }
+
+            this->output_instance[output]->set_fs_shader(chain);
+            update_watches();
+        }
+
+        LOGI("Shader loaded asynchronously, program cache ", program_cache_result_to_string(cache_result));
+        send_async_event(job.token, request, "filters/shader-ready");
+    }
+
+    wf::signal::connection_t<wf::ipc::client_disconnected_signal> on_client_disconnected =
+        [=] (wf::ipc::client_disconnected_signal *ev)
+    {
+        events->clients.erase(ev->client);
+        for (auto& [token, request] : async_requests)
+        {
+            if (request.client == ev->client)
+            {
+                request.client = nullptr;
+            }
+        }
+    };
+
+    /*
+     * A pass is either a shader path or an object selecting a built-in
+     * effect, currently only {"builtin": "blur", "radius": 2.0, "iterations": 3}
+     * with both parameters optional.
+     */
+    std::optional<filter_pass_t> get_filter_pass(const wf::json_t& item)
+    {
+        if (item.is_string())
+        {
+            return filter_pass_t{item.as_string(), "", {}};
+        }
+
+        if (!item.is_object() || !item.has_member("builtin") || !item["builtin"].is_string() ||
+            (item["builtin"].as_string() != "blur"))
+        {
+            return {};
+        }
+
+        blur_params_t blur;
+        if (item.has_member("radius"))
+        {
+            if (item["radius"].is_int())
+            {
+                blur.radius = item["radius"].as_int();
+            } else if (item["radius"].is_double())
+            {
+                blur.radius = item["radius"].as_double();
+            } else
+            {
+                return {};
+            }
+        }
+
+        if (item.has_member("iterations"))
+        {
+            if (!item["iterations"].is_int())
+            {
+                return {};
+            }
+
+            blur.iterations = item["iterations"].as_int();
+        }
+
+        if ((blur.radius < 0.0) || (blur.iterations < 1) || (blur.iterations > 8))
+        {
+            return {};
+        }
+
+        return filter_pass_t{"", "", blur};
+    }
+
+    /*
+     * "shader-path" is either a single pass or an array of passes which are
+     * applied in order. Returns an empty list if it is malformed.
+     */
+    std::vector<filter_pass_t> get_filter_passes(const wf::json_t& data)
+    {
+        if (!data.has_member("shader-path") || data["shader-path"].is_string())
+        {
+            return {{wf::ipc::json_get_string(data, "shader-path"), "", {}}};
+        }
+
+        if (!data["shader-path"].is_array())
+        {
+            auto pass = get_filter_pass(data["shader-path"]);
+            return pass ? std::vector<filter_pass_t>{*pass} : std::vector<filter_pass_t>{};
+        }
+
+        std::vector<filter_pass_t> passes;
+        for (size_t i = 0; i < data["shader-path"].size(); i++)
+        {
+            auto pass = get_filter_pass(data["shader-path"][i]);
+            if (!pass)
+            {
+                return {};
+            }
+
+            passes.push_back(*pass);
+        }
+
+        return passes;
+    }
+
+    /* Read and compile the shaders of @rule once, for all views it matches */
+    bool compile_rule(filter_rule_t& rule)
+    {
+        if (!load_shader_sources(rule.passes))
+        {
+            return false;
+        }
+
+        rule.chain = programs->acquire_chain(rule.passes);
+        return rule.chain != nullptr;
+    }
+
+    /* Returns an error message, or an empty string on success */
+    std::string set_rule_condition(filter_rule_t& rule, const std::string& key, const std::string& value)
+    {
+        if (key == "app-id")
+        {
+            rule.app_id = value;
+        } else if (key == "title")
+        {
+            rule.title = value;
+        } else if (key == "output")
+        {
+            rule.output = value;
+        } else if ((key == "tiled") || (key == "focused") || (key == "fullscreen"))
+        {
+            if ((value != "true") && (value != "false"))
+            {
+                return key + " must be true or false";
+            }
+
+            auto& condition = (key == "tiled") ? rule.tiled :
+                (key == "focused") ? rule.focused : rule.fullscreen;
+            condition = (value == "true");
+        } else
+        {
+            return "Unknown rule condition " + key;
+        }
+
+        return "";
+    }
+
+    /*
+     * Conditions from the config are key=value pairs separated by spaces,
+     * with optionally quoted values: app-id=foot title="* - Mozilla Firefox"
+     */
+    std::string parse_rule_conditions(const std::string& conditions, filter_rule_t& rule)
+    {
+        size_t pos = 0;
+        while ((pos = conditions.find_first_not_of(' ', pos)) != std::string::npos)
+        {
+            auto eq = conditions.find('=', pos);
+            if (eq == std::string::npos)
+            {
+                return "Expected key=value, got " + conditions.substr(pos);
+            }
+
+            auto key = conditions.substr(pos, eq - pos);
+            std::string value;
+            if ((eq + 1 < conditions.size()) && (conditions[eq + 1] == '"'))
+            {
+                auto close = conditions.find('"', eq + 2);
+                if (close == std::string::npos)
+                {
+                    return "Unterminated quote in " + key;
+                }
+
+                value = conditions.substr(eq + 2, close - eq - 2);
+                pos   = close + 1;
+            } else
+            {
+                pos   = conditions.find(' ', eq);
+                value = conditions.substr(eq + 1, pos - eq - 1);
+            }
+
+            auto error = set_rule_condition(rule, key, value);
+            if (!error.empty())
+            {
+                return error;
+            }
+        }
+
+        return "";
+    }
+
+    /*
+     * Passes from the config are separated by spaces, each is a shader path
+     * or blur[:radius[:iterations]]. Returns an empty list if one is malformed.
+     */
+    std::vector<filter_pass_t> parse_pass_list(const std::string& list)
+    {
+        std::vector<filter_pass_t> passes;
+        size_t pos = 0;
+        while ((pos = list.find_first_not_of(' ', pos)) != std::string::npos)
+        {
+            auto end  = list.find(' ', pos);
+            auto word = list.substr(pos, end - pos);
+            pos = end;
+
+            if ((word != "blur") && (word.rfind("blur:", 0) != 0))
+            {
+                passes.push_back({word, "", {}});
+                continue;
+            }
+
+            wf::json_t item;
+            item["builtin"] = "blur";
+            if (word.size() > 4)
+            {
+                char *params_end;
+                item["radius"] = std::strtod(word.c_str() + 5, &params_end);
+                if (*params_end == ':')
+                {
+                    item["iterations"] = (int)std::strtol(params_end + 1, &params_end, 10);
+                }
+
+                if (*params_end)
+                {
+                    return {};
+                }
+            }
+
+            auto pass = get_filter_pass(item);
+            if (!pass)
+            {
+                return {};
+            }
+
+            passes.push_back(*pass);
+        }
+
+        return passes;
+    }
+
+    /* Config rules are named by their key suffix and skipped if invalid */
+    void load_config_rules()
+    {
+        config_rules.clear();
+        for (auto& [name, conditions, shaders] : rules_option.value())
+        {
+            auto rule  = std::make_shared<filter_rule_t>();
+            auto error = parse_rule_conditions(conditions, *rule);
+            if (error.empty())
+            {
+                rule->passes = parse_pass_list(shaders);
+                if (rule->passes.empty())
+                {
+                    error = "Invalid shader list " + shaders;
+                } else if (!compile_rule(*rule))
+                {
+                    error = "Failed to compile shader.";
+                }
+            }
+
+            if (!error.empty())
+            {
+                LOGE("Skipping filter rule ", name, ": ", error);
+                continue;
+            }
+
+            config_rules.push_back(rule);
+        }
+
+        reapply_rules();
+    }
+
+    std::shared_ptr<filter_rule_t> find_rule(wayfire_toplevel_view view)
+    {
+        for (auto rules : {&ipc_rules, &config_rules})
+        {
+            for (auto& rule : *rules)
+            {
+                if (rule->matches(view))
+                {
+                    return rule;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    /*
+     * Give @view the filter of the first rule it matches, or remove the
+     * filter a rule gave it if none match anymore. Filters set over IPC
+     * take precedence and are left alone.
+     */
+    void apply_rules(wayfire_view view)
+    {
+        auto toplevel = wf::toplevel_cast(view);
+        if (!toplevel || !view->is_mapped() || (view->role != wf::VIEW_ROLE_TOPLEVEL))
+        {
+            return;
+        }
+
+        auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+        if (tr && tr->unapplied())
+        {
+            tr = nullptr;
+        }
+
+        if (tr && !tr->rule)
+        {
+            return;
+        }
+
+        auto rule = find_rule(toplevel);
+        if ((tr ? tr->rule : nullptr) == rule)
+        {
+            return;
+        }
+
+        if (rule)
+        {
+            ensure_transformer(view, std::make_shared<filter_chain_t>(*rule->chain))->rule = rule;
+        } else
         {
-            wf::gles::run_in_context([&]
+            tr->unapply();
+        }
+
+        view->damage();
+    }
+
+    void reapply_rules()
+    {
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            apply_rules(view);
+        }
+
+        update_watches();
+    }
+
+    wf::signal::connection_t<wf::view_mapped_signal> on_view_mapped = [=] (wf::view_mapped_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    wf::signal::connection_t<wf::view_set_output_signal> on_view_set_output =
+        [=] (wf::view_set_output_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    wf::signal::connection_t<wf::view_tiled_signal> on_view_tiled = [=] (wf::view_tiled_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    wf::signal::connection_t<wf::view_fullscreen_signal> on_view_fullscreen =
+        [=] (wf::view_fullscreen_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    wf::signal::connection_t<wf::view_activated_state_signal> on_view_activated =
+        [=] (wf::view_activated_state_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    wf::signal::connection_t<wf::view_title_changed_signal> on_title_changed =
+        [=] (wf::view_title_changed_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    wf::signal::connection_t<wf::view_app_id_changed_signal> on_app_id_changed =
+        [=] (wf::view_app_id_changed_signal *ev)
+    {
+        apply_rules(ev->view);
+    };
+
+    /*
+     * A single "view-id" or "output-name" names one target. An array of
+     * them, or "all", makes a batch request: shaders are read and compiled
+     * once for every target, and the reply has a result for each target
+     * under "views" or "outputs".
+     */
+    static bool is_batch(const wf::json_t& data, const std::string& key)
+    {
+        return data.has_member(key) && (data[key].is_array() ||
+            (data[key].is_string() && (data[key].as_string() == "all")));
+    }
+
+    /* The views of a batch request by id, "all" is every mapped toplevel */
+    std::optional<std::map<uint64_t, wayfire_view>> get_batch_views(const wf::json_t& data)
+    {
+        std::map<uint64_t, wayfire_view> all;
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            all[view->get_id()] = view;
+        }
+
+        std::map<uint64_t, wayfire_view> views;
+        if (data["view-id"].is_string())
+        {
+            for (auto& [id, view] : all)
             {
-                program->free_resources();
-            });
-        } else
+                if (view->is_mapped() && (view->role == wf::VIEW_ROLE_TOPLEVEL))
+                {
+                    views[id] = view;
+                }
+            }
+
+            return views;
+        }
+
+        for (size_t i = 0; i < data["view-id"].size(); i++)
         {
-            program = std::make_shared<OpenGL::program_t>();
+            if (!data["view-id"][i].is_uint64())
+            {
+                return {};
+            }
+
+            auto id  = data["view-id"][i].as_uint64();
+            auto it  = all.find(id);
+            views[id] = (it == all.end()) ? nullptr : it->second;
         }
 
-        std::ifstream t(shader);
-        std::string fragment_shader((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-        wf::gles::run_in_context([&]
+        return views;
+    }
+
+    /* The outputs of a batch request by name, "all" is every output */
+    std::optional<std::map<std::string, wf::output_t*>> get_batch_outputs(const wf::json_t& data)
+    {
+        std::map<std::string, wf::output_t*> outputs;
+        if (data["output-name"].is_string())
+        {
+            for (auto& output : wf::get_core().output_layout->get_outputs())
+            {
+                outputs[output->to_string()] = output;
+            }
+
+            return outputs;
+        }
+
+        for (size_t i = 0; i < data["output-name"].size(); i++)
+        {
+            if (!data["output-name"][i].is_string())
+            {
+                return {};
+            }
+
+            auto name = data["output-name"][i].as_string();
+            outputs[name] = find_output_by_name(name);
+        }
+
+        return outputs;
+    }
+
+    /*
+     * Run @action on every target of a batch request and collect the
+     * results under @list_key. Targets which do not exist get @missing as
+     * their error.
+     */
+    template<class Id, class Target, class Action>
+    wf::json_t run_batch(const std::map<Id, Target>& targets, const std::string& id_key,
+        const std::string& list_key, const std::string& missing, Action action)
+    {
+        auto results = wf::json_t::array();
+        for (auto& [id, target] : targets)
+        {
+            auto result = target ? action(target) : wf::ipc::json_error(missing);
+            result[id_key] = id;
+            results.append(result);
+        }
+
+        auto response = wf::ipc::json_ok();
+        response[list_key] = results;
+        return response;
+    }
+
+    /* Read and compile @passes once for all targets of a batch request */
+    std::shared_ptr<filter_chain_t> load_batch_chain(std::vector<filter_pass_t> passes,
+        program_cache_result_t *cache_result, std::string& error)
+    {
+        if (!load_shader_sources(passes))
+        {
+            LOGE("Failed to read shader.");
+            error = "Failed to read shader.";
+            return nullptr;
+        }
+
+        auto chain = programs->acquire_chain(passes, cache_result);
+        if (!chain)
+        {
+            LOGE("Failed to compile shader.");
+            error = "Failed to compile shader.";
+        }
+
+        return chain;
+    }
+
+    wf::json_t set_view_shaders(const std::map<uint64_t, wayfire_view>& views,
+        const std::vector<filter_pass_t>& passes, bool backdrop)
+    {
+        std::string error;
+        program_cache_result_t cache_result;
+        auto chain = load_batch_chain(passes, &cache_result, error);
+        if (!chain)
+        {
+            for (auto& [id, view] : views)
+            {
+                send_compile_failed({nullptr, id, ""}, passes, error);
+            }
+
+            return wf::ipc::json_error(error);
+        }
+
+        /* Each view gets its own copy, so that its uniforms are its own */
+        auto response = run_batch(views, "view-id", "views", "Failed to find view with given id.",
+            [&] (wayfire_view view)
+        {
+            cancel_async_requests(view->get_id(), "");
+            return set_view_shader(view, std::make_shared<filter_chain_t>(*chain), backdrop);
+        });
+        response["program-cache"] = program_cache_result_to_string(cache_result);
+        return response;
+    }
+
+    wf::json_t set_fs_shaders(const std::map<std::string, wf::output_t*>& outputs,
+        const std::vector<filter_pass_t>& passes)
+    {
+        std::string error;
+        program_cache_result_t cache_result;
+        auto chain = load_batch_chain(passes, &cache_result, error);
+        if (!chain)
+        {
+            for (auto& [name, output] : outputs)
+            {
+                send_compile_failed({nullptr, 0, name}, passes, error);
+            }
+
+            return wf::ipc::json_error(error);
+        }
+
+        auto response = run_batch(outputs, "output-name", "outputs", "No such output",
+            [&] (wf::output_t *output)
         {
-            program->compile(vertex_shader, fragment_shader);
+            cancel_async_requests(0, output->to_string());
+            this->output_instance[output]->set_fs_shader(std::make_shared<filter_chain_t>(*chain));
+            return wf::ipc::json_ok();
         });
-        if (program->get_program_id(wf::TEXTURE_TYPE_RGBA) == 0)
+        update_watches();
+        response["program-cache"] = program_cache_result_to_string(cache_result);
+        return response;
+    }
+
+    wf::json_t unset_view_shader(wayfire_view view)
+    {
+        cancel_async_requests(view->get_id(), "");
+        auto tmgr = view->get_transformed_node();
+        if (auto tr = tmgr->get_transformer<wf_filters>(transformer_name))
+        {
+            tr->unapply();
+            view->damage();
+        }
+
+        return wf::ipc::json_ok();
+    }
+
+    wf::json_t view_has_shader(wayfire_view view)
+    {
+        auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+        auto response = wf::ipc::json_ok();
+        response["has-shader"] = tr ? true : false;
+        response["fading-out"] = tr && tr->unapplied();
+        return response;
+    }
+
+    wf::ipc::method_callback_full ipc_set_view_shader =
+        [=] (wf::json_t data, wf::ipc::client_interface_t *client) -> wf::json_t
+    {
+        auto async    = wf::ipc::json_get_optional_bool(data, "async").value_or(false);
+        auto backdrop = wf::ipc::json_get_optional_bool(data, "backdrop").value_or(false);
+        auto passes   = get_filter_passes(data);
+        if (passes.empty())
+        {
+            return wf::ipc::json_error(
+                "shader-path must be a path, a built-in pass or a non-empty array of them");
+        }
+
+        if (is_batch(data, "view-id"))
+        {
+            auto views = get_batch_views(data);
+            if (!views || async)
+            {
+                return wf::ipc::json_error("Batches need an array of view ids or \"all\", and no async");
+            }
+
+            return set_view_shaders(*views, passes, backdrop);
+        }
+
+        auto view_id = wf::ipc::json_get_uint64(data, "view-id");
+        auto view    = wf::ipc::find_view_by_id(view_id);
+        if (!view)
+        {
+            LOGE("Failed to find view with given id. Maybe it isn't mapped?");
+            return wf::ipc::json_error("Failed to find view with given id. Maybe it isn't mapped?");
+        }
+
+        if (async)
+        {
+            return submit_async_request(client, view_id, "", passes, backdrop);
+        }
+
+        cancel_async_requests(view_id, "");
+        if (!load_shader_sources(passes))
+        {
+            pop_transformer(view);
+            LOGE("Failed to read shader.");
+            send_compile_failed({nullptr, view_id, ""}, passes, "Failed to read shader.");
+            return wf::ipc::json_error("Failed to read shader.");
+        }
+
+        program_cache_result_t cache_result;
+        auto chain = programs->acquire_chain(passes, &cache_result);
+        if (!chain)
+        {
+            pop_transformer(view);
+            LOGE("Failed to compile shader.");
+            send_compile_failed({nullptr, view_id, ""}, passes, "Failed to compile shader.");
+            return wf::ipc::json_error("Failed to compile shader.");
+        }
+
+        auto response = set_view_shader(view, chain, backdrop);
+        response["program-cache"] = program_cache_result_to_string(cache_result);
+        return response;
+    };
+
+    wf::ipc::method_callback ipc_unset_view_shader = [=] (wf::json_t data) -> wf::json_t
+    {
+        if (is_batch(data, "view-id"))
+        {
+            auto views = get_batch_views(data);
+            if (!views)
+            {
+                return wf::ipc::json_error("Batches need an array of view ids or \"all\"");
+            }
+
+            return run_batch(*views, "view-id", "views", "Failed to find view with given id.",
+                [&] (wayfire_view view) { return unset_view_shader(view); });
+        }
+
+        auto view_id = wf::ipc::json_get_uint64(data, "view-id");
+        auto view    = wf::ipc::find_view_by_id(view_id);
+        if (!view)
+        {
+            cancel_async_requests(view_id, "");
+            return wf::ipc::json_ok();
+        }
+
+        return unset_view_shader(view);
+    };
+
+    wf::ipc::method_callback ipc_view_has_shader = [=] (wf::json_t data) -> wf::json_t
+    {
+        if (is_batch(data, "view-id"))
+        {
+            auto views = get_batch_views(data);
+            if (!views)
+            {
+                return wf::ipc::json_error("Batches need an array of view ids or \"all\"");
+            }
+
+            return run_batch(*views, "view-id", "views", "Failed to find view with given id.",
+                [&] (wayfire_view view) { return view_has_shader(view); });
+        }
+
+        auto view_id = wf::ipc::json_get_uint64(data, "view-id");
+
+        auto view = wf::ipc::find_view_by_id(view_id);
+        if (!view)
+        {
+            return wf::ipc::json_error("Failed to find view with given id.");
+        }
+
+        return view_has_shader(view);
+    };
+
+    wf::output_t *find_output_by_name(std::string name)
+    {
+        return wf::get_core().output_layout->find_output(name);
+    }
+
+    wf::ipc::method_callback_full ipc_set_fs_shader =
+        [=] (wf::json_t data, wf::ipc::client_interface_t *client) -> wf::json_t
+    {
+        auto async  = wf::ipc::json_get_optional_bool(data, "async").value_or(false);
+        auto passes = get_filter_passes(data);
+        if (passes.empty())
+        {
+            return wf::ipc::json_error(
+                "shader-path must be a path, a built-in pass or a non-empty array of them");
+        }
+
+        if (is_batch(data, "output-name"))
+        {
+            auto outputs = get_batch_outputs(data);
+            if (!outputs || async)
+            {
+                return wf::ipc::json_error("Batches need an array of output names or \"all\", and no async");
+            }
+
+            return set_fs_shaders(*outputs, passes);
+        }
+
+        auto output_name = wf::ipc::json_get_string(data, "output-name");
+        auto output = find_output_by_name(output_name);
+        if (!output)
+        {
+            return wf::ipc::json_error("No such output");
+        }
+
+        if (async)
+        {
+            return submit_async_request(client, 0, output_name, passes);
+        }
+
+        cancel_async_requests(0, output_name);
+        auto response = this->output_instance[output]->set_fs_shader(passes);
+        update_watches();
+        return response;
+    };
+
+    wf::ipc::method_callback ipc_unset_fs_shader = [=] (wf::json_t data) -> wf::json_t
+    {
+        if (is_batch(data, "output-name"))
+        {
+            auto outputs = get_batch_outputs(data);
+            if (!outputs)
+            {
+                return wf::ipc::json_error("Batches need an array of output names or \"all\"");
+            }
+
+            return run_batch(*outputs, "output-name", "outputs", "No such output",
+                [&] (wf::output_t *output)
+            {
+                cancel_async_requests(0, output->to_string());
+                return this->output_instance[output]->unset_fs_shader();
+            });
+        }
+
+        auto output_name = wf::ipc::json_get_string(data, "output-name");
+
+        cancel_async_requests(0, output_name);
+        auto output = find_output_by_name(output_name);
+        if (!output)
+        {
+            return wf::ipc::json_error("No such output");
+        }
+
+        return this->output_instance[output]->unset_fs_shader();
+    };
+
+    /*
+     * Run the fullscreen filters of outputs at a fraction of their
+     * resolution. Without a scale, the outputs follow filters/fs_scale.
+     */
+    wf::ipc::method_callback ipc_set_fs_scale = [=] (wf::json_t data) -> wf::json_t
+    {
+        std::optional<double> scale;
+        if (data.has_member("scale"))
+        {
+            if (data["scale"].is_int())
+            {
+                scale = data["scale"].as_int();
+            } else if (data["scale"].is_double())
+            {
+                scale = data["scale"].as_double();
+            }
+
+            if (!scale || (*scale <= 0.0) || (*scale > 1.0))
+            {
+                return wf::ipc::json_error("scale must be a number greater than 0 and at most 1");
+            }
+        }
+
+        if (is_batch(data, "output-name"))
+        {
+            auto outputs = get_batch_outputs(data);
+            if (!outputs)
+            {
+                return wf::ipc::json_error("Batches need an array of output names or \"all\"");
+            }
+
+            return run_batch(*outputs, "output-name", "outputs", "No such output",
+                [&] (wf::output_t *output)
+            {
+                return this->output_instance[output]->set_scale(scale);
+            });
+        }
+
+        auto output = find_output_by_name(wf::ipc::json_get_string(data, "output-name"));
+        if (!output)
         {
-            LOGE("Failed to compile fullscreen shader.");
-            output->render->rem_post(&hook);
-            program = nullptr;
-            return wf::ipc::json_error("Failed to compile fullscreen shader.");
+            return wf::ipc::json_error("No such output");
         }
 
-        output->render->damage_whole();
+        return this->output_instance[output]->set_scale(scale);
+    };
 
-        if (active)
+    wf::ipc::method_callback ipc_fs_has_shader = [=] (wf::json_t data) -> wf::json_t
+    {
+        if (is_batch(data, "output-name"))
         {
-            LOGI("Successfully compiled and applied fullscreen shader to output: ", output->to_string());
-            return wf::ipc::json_ok();
+            auto outputs = get_batch_outputs(data);
+            if (!outputs)
+            {
+                return wf::ipc::json_error("Batches need an array of output names or \"all\"");
+            }
+
+            return run_batch(*outputs, "output-name", "outputs", "No such output",
+                [&] (wf::output_t *output) { return this->output_instance[output]->fs_has_shader(); });
         }
 
-        output->render->add_post(&hook);
-        output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
-        fade->animate(1.0);
-        active = true;
+        auto output_name = wf::ipc::json_get_string(data, "output-name");
 
-        LOGI("Successfully compiled and applied fullscreen shader to output: ", output->to_string());
-        return wf::ipc::json_ok();
-    }
+        auto output = find_output_by_name(output_name);
+        if (!output)
+        {
+            return wf::ipc::json_error("No such output");
+        }
 
-    wf::json_t unset_fs_shader()
-    {
-        fade->animate(0.0);
-        return wf::ipc::json_ok();
-    }
+        return this->output_instance[output]->fs_has_shader();
+    };
 
-    wf::json_t fs_has_shader()
+    /*
+     * Run @chain over an identity LUT of @size entries per axis, laid out
+     * as a strip of blue slices, and read the mapped colors back. Empty if
+     * the chain changes alpha, which a .cube file cannot hold.
+     */
+    std::optional<lut_t> bake_lut(filter_chain_t& chain, int size)
     {
-        auto response = wf::ipc::json_ok();
-        response["has-shader"] = active;
-        return response;
-    }
+        auto lut = lut_identity(size);
+        wf::dimensions_t strip = {size * size, size};
+        std::vector<uint8_t> pixels(4 * strip.width * strip.height);
+        for (size_t i = 0; i < pixels.size() / 4; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                pixels[4 * i + c] = std::round(lut.data[3 * i + c] * 255.0);
+            }
 
-    void render(wf::auxilliary_buffer_t& aux_buf, const wf::render_buffer_t& render_buf)
-    {
-        static const float vertexData[] = {
-            -1.0f, -1.0f,
-            1.0f, -1.0f,
-            1.0f, 1.0f,
-            -1.0f, 1.0f
-        };
-        static const float texCoords[] = {
-            0.0f, 1.0f,
-            1.0f, 1.0f,
-            1.0f, 0.0f,
-            0.0f, 0.0f
-        };
+            pixels[4 * i + 3] = 255;
+        }
 
         wf::gles::run_in_context([&]
         {
-            /* Upload data to shader */
-            program->use(wf::TEXTURE_TYPE_RGBA);
-            program->attrib_pointer("position", 2, 0, vertexData);
-            program->attrib_pointer("texcoord", 2, 0, texCoords);
-            program->uniformMatrix4f("mvp", glm::mat4(1.0));
-            program->uniform1f("progress", *fade);
-            program->uniform1i("in_tex", 0);
-            GL_CALL(glActiveTexture(GL_TEXTURE0));
-            program->set_active_texture(wf::gles_texture_t::from_aux(aux_buf));
+            auto input  = buffers->acquire(strip);
+            auto output = buffers->acquire(strip);
+            auto input_tex = wf::gles_texture_t::from_aux(*input);
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, input_tex.tex_id));
+            GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, strip.width, strip.height, GL_RGBA,
+                GL_UNSIGNED_BYTE, pixels.data()));
 
-            /* Render it to aux_buf */
-            wf::gles::bind_render_buffer(render_buf);
-            GL_CALL(glViewport(0, 0, aux_buf.get_size().width, aux_buf.get_size().height));
-
-            GL_CALL(glEnable(GL_BLEND));
-            GL_CALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+            run_filter_chain(chain, input_tex, strip, *buffers.get(),
+                [&] (filter_program_t *program, const wf::gles_texture_t& texture,
+                     wf::auxilliary_buffer_t *buffer, const uniform_setter_t& uniforms, int)
+            {
+                program->program.use(wf::TEXTURE_TYPE_RGBA);
+                bind_quad(program, false);
+                set_uniform(program, "mvp", glm::mat4(1.0));
+                set_uniform(program, "progress", 1.0f);
+                set_uniform(program, "in_tex", 0.0f);
+                GL_CALL(glActiveTexture(GL_TEXTURE0));
+                program->program.set_active_texture(texture);
+                if (uniforms)
+                {
+                    uniforms(program);
+                }
 
-            GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                /* Table entries must be read back exactly */
+                GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+                GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+                wf::gles::bind_render_buffer((buffer ? buffer : output.get())->get_renderbuffer());
+                GL_CALL(glViewport(0, 0, strip.width, strip.height));
+                GL_CALL(glDisable(GL_SCISSOR_TEST));
+                GL_CALL(glDisable(GL_BLEND));
+                GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, 0, 4));
+                GL_CALL(glBindVertexArray(0));
+                program->program.deactivate();
+            });
 
-            /* Disable stuff */
-            GL_CALL(glDisable(GL_BLEND));
-            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            wf::gles::bind_render_buffer(output->get_renderbuffer());
+            GL_CALL(glReadPixels(0, 0, strip.width, strip.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data()));
             GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
             GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
-
-            program->deactivate();
+            buffers->release(std::move(input));
+            buffers->release(std::move(output));
         });
-    }
 
-    void fini() override
-    {
-        output->render->rem_effect(&pre_hook);
-        output->render->rem_post(&hook);
-        output->render->damage_whole();
-        if (program)
+        for (size_t i = 0; i < pixels.size() / 4; i++)
         {
-            wf::gles::run_in_context([&]
+            if (pixels[4 * i + 3] != 255)
             {
-                program->free_resources();
-            });
+                return {};
+            }
+
+            for (int c = 0; c < 3; c++)
+            {
+                lut.data[3 * i + c] = pixels[4 * i + c] / 255.0f;
+            }
         }
 
-        fade.reset();
+        return lut;
     }
-};
-
-class wayfire_filters : public wf::plugin_interface_t,
-    public wf::per_output_tracker_mixin_t<wayfire_per_output_filters>
-{
-    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> ipc_repo;
 
-    void pop_transformer(wayfire_view view)
+    /*
+     * Bake a chain of color only passes, with optional "uniforms" as for
+     * set-uniforms, into one LUT of "size" entries per axis written to the
+     * absolute "path" as a .cube file. An existing file is only replaced
+     * with "overwrite": true. Entries are read back with 8 bits per
+     * channel, which the reply states as "precision-bits".
+     */
+    wf::ipc::method_callback ipc_bake_lut = [=] (wf::json_t data) -> wf::json_t
     {
-        if (view->get_transformed_node()->get_transformer(transformer_name))
+        auto path  = wf::ipc::json_get_string(data, "path");
+        auto size  = wf::ipc::json_get_optional_int64(data, "size").value_or(33);
+        auto passes = get_filter_passes(data);
+        if (passes.empty())
         {
-            LOGI("Removing shader and transformer.");
-            view->get_transformed_node()->rem_transformer(transformer_name);
+            return wf::ipc::json_error(
+                "shader-path must be a path, a built-in pass or a non-empty array of them");
         }
-    }
 
-    void remove_transformers()
-    {
-        for (auto& view : wf::get_core().get_all_views())
+        if ((size < 2) || (size > 64))
         {
-            pop_transformer(view);
+            return wf::ipc::json_error("size must be between 2 and 64");
         }
-    }
 
-  public:
-    void init() override
-    {
-        ipc_repo->register_method("wf/filters/set-view-shader", ipc_set_view_shader);
-        ipc_repo->register_method("wf/filters/unset-view-shader", ipc_unset_view_shader);
-        ipc_repo->register_method("wf/filters/view-has-shader", ipc_view_has_shader);
-        ipc_repo->register_method("wf/filters/set-fs-shader", ipc_set_fs_shader);
-        ipc_repo->register_method("wf/filters/unset-fs-shader", ipc_unset_fs_shader);
-        ipc_repo->register_method("wf/filters/fs-has-shader", ipc_fs_has_shader);
+        auto overwrite = wf::ipc::json_get_optional_bool(data, "overwrite").value_or(false);
+        std::filesystem::path target = path;
+        if (!target.is_absolute() || (target.extension() != ".cube"))
+        {
+            return wf::ipc::json_error("path must be an absolute path to a .cube file");
+        }
 
-        per_output_tracker_mixin_t::init_output_tracking();
-    }
+        std::error_code ec;
+        if (!overwrite && std::filesystem::exists(target, ec))
+        {
+            return wf::ipc::json_error(path + " exists, pass overwrite to replace it");
+        }
 
-    void handle_new_output(wf::output_t *output) override
-    {
-        per_output_tracker_mixin_t::handle_new_output(output);
-    }
+        if (!load_shader_sources(passes))
+        {
+            return wf::ipc::json_error("Failed to read shader.");
+        }
 
-    void handle_output_removed(wf::output_t *output) override
-    {
-        per_output_tracker_mixin_t::handle_output_removed(output);
-    }
+        auto chain = programs->acquire_chain(passes);
+        if (!chain)
+        {
+            return wf::ipc::json_error("Failed to compile shader.");
+        }
 
-    std::shared_ptr<wf_filters> ensure_transformer(wayfire_view view, std::string shader_path)
-    {
-        auto tmgr = view->get_transformed_node();
-        if (tmgr->get_transformer<wf_filters>(transformer_name))
+        if (!chain->color_only() || chain->time_dependent())
         {
-            view->get_transformed_node()->rem_transformer(transformer_name);
+            return wf::ipc::json_error(
+                "Only passes which depend on nothing but the input color and do not change over time can be baked");
         }
 
-        auto node = std::make_shared<wf_filters>(view, shader_path);
-        tmgr->add_transformer(node, wf::TRANSFORMER_2D, transformer_name);
+        if (data.has_member("uniforms"))
+        {
+            auto error = set_chain_uniforms(*chain, data["uniforms"]);
+            if (!error.empty())
+            {
+                return wf::ipc::json_error(error);
+            }
 
-        return tmgr->get_transformer<wf_filters>(transformer_name);
-    }
+            if (!programs->specialize(*chain))
+            {
+                return wf::ipc::json_error("Failed to compile specialized shader");
+            }
+        }
 
-    wf::ipc::method_callback ipc_set_view_shader = [=] (wf::json_t data) -> wf::json_t
-    {
-        auto view_id     = wf::ipc::json_get_uint64(data, "view-id");
-        auto shader_path = wf::ipc::json_get_string(data, "shader-path");
+        auto lut = bake_lut(*chain, size);
+        if (!lut)
+        {
+            return wf::ipc::json_error("Passes which change alpha cannot be baked");
+        }
 
-        auto view = wf::ipc::find_view_by_id(view_id);
-        if (view)
+        /* Write a temporary file first, so that a failed bake leaves an existing LUT alone */
+        auto tmp = path + ".tmp";
         {
-            auto tr = ensure_transformer(view, shader_path);
-            if (tr->program.get_program_id(wf::TEXTURE_TYPE_RGBA) == 0)
+            std::ofstream file(tmp, std::ios::trunc);
+            file << lut_to_cube(*lut, "Baked by wayfire filters");
+            if (!file.good())
             {
-                pop_transformer(view);
-                LOGE("Failed to compile shader.");
-                return wf::ipc::json_error("Failed to compile shader.");
+                return wf::ipc::json_error("Failed to write " + tmp);
             }
-        } else
+        }
+
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
         {
-            LOGE("Failed to find view with given id. Maybe it isn't mapped?");
-            return wf::ipc::json_error("Failed to find view with given id. Maybe it isn't mapped?");
+            std::filesystem::remove(tmp, ec);
+            return wf::ipc::json_error("Failed to write " + path);
         }
 
-        LOGI("Successfully compiled and applied shader.");
-        view->damage();
-        return wf::ipc::json_ok();
+        auto response = wf::ipc::json_ok();
+        response["precision-bits"] = 8;
+        return response;
     };
 
-    wf::ipc::method_callback ipc_unset_view_shader = [=] (wf::json_t data) -> wf::json_t
+    /*
+     * The cost of every filter over its last frames, while filters/stats
+     * is enabled. Each entry has "stats" with the rolling average and 99th
+     * percentile of CPU and GPU time in milliseconds, and of pixels shaded,
+     * rectangles drawn and program binds per frame.
+     */
+    wf::ipc::method_callback ipc_stats = [=] (wf::json_t) -> wf::json_t
     {
-        auto view_id = wf::ipc::json_get_uint64(data, "view-id");
+        if (!collect_stats)
+        {
+            return wf::ipc::json_error("Stats are not collected, enable filters/stats");
+        }
 
-        auto view = wf::ipc::find_view_by_id(view_id);
-        if (view)
+        auto views = wf::json_t::array();
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+            if (!tr || !tr->stats)
+            {
+                continue;
+            }
+
+            wf::json_t entry;
+            entry["view-id"]     = view->get_id();
+            entry["app-id"]      = view->get_app_id();
+            entry["shader-path"] = pass_list_to_json(tr->chain->passes);
+            entry["stats"] = tr->stats->to_json();
+            views.append(entry);
+        }
+
+        auto outputs = wf::json_t::array();
+        for (auto& output : wf::get_core().output_layout->get_outputs())
         {
-            auto tmgr = view->get_transformed_node();
-            if (auto tr = tmgr->get_transformer<wf_filters>(transformer_name))
+            if (auto entry = this->output_instance[output]->stats_to_json())
             {
-                tr->unapply();
-                view->damage();
+                outputs.append(*entry);
             }
         }
 
+        auto response = wf::ipc::json_ok();
+        response["views"]   = views;
+        response["outputs"] = outputs;
+        return response;
+    };
+
+    /* Estimated GPU memory of the filters, in bytes, see memory_tracker_t */
+    wf::ipc::method_callback ipc_memory = [=] (wf::json_t) -> wf::json_t
+    {
+        auto response = wf::ipc::json_ok();
+        response["memory"] = memory->to_json();
+        return response;
+    };
+
+    /*
+     * Send the client an event on each change of filter state:
+     * filters/applied, filters/fade-in-done, filters/fade-out-started,
+     * filters/removed and filters/compile-failed. Events carry the
+     * "view-id" or "output-name" of the target and its "shader-path".
+     */
+    wf::ipc::method_callback_full ipc_watch =
+        [=] (wf::json_t, wf::ipc::client_interface_t *client) -> wf::json_t
+    {
+        events->clients.insert(client);
         return wf::ipc::json_ok();
     };
 
-    wf::ipc::method_callback ipc_view_has_shader = [=] (wf::json_t data) -> wf::json_t
+    /* Every filter being applied, on views under "views" and on outputs under "outputs" */
+    wf::ipc::method_callback ipc_list = [=] (wf::json_t) -> wf::json_t
     {
-        auto view_id = wf::ipc::json_get_uint64(data, "view-id");
+        auto views = wf::json_t::array();
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+            if (!tr || tr->unapplied())
+            {
+                continue;
+            }
 
-        auto view = wf::ipc::find_view_by_id(view_id);
-        if (!view)
+            wf::json_t entry;
+            entry["view-id"]     = view->get_id();
+            entry["app-id"]      = view->get_app_id();
+            entry["title"]       = view->get_title();
+            entry["shader-path"] = pass_list_to_json(tr->chain->passes);
+            entry["backdrop"]    = tr->chain->backdrop;
+            entry["from-rule"]   = tr->rule ? true : false;
+            views.append(entry);
+        }
+
+        auto outputs = wf::json_t::array();
+        for (auto& output : wf::get_core().output_layout->get_outputs())
         {
-            return wf::ipc::json_error("Failed to find view with given id.");
+            if (auto entry = this->output_instance[output]->describe())
+            {
+                outputs.append(*entry);
+            }
         }
 
-        auto tmgr     = view->get_transformed_node();
         auto response = wf::ipc::json_ok();
-        response["has-shader"] = tmgr->get_transformer<wf::scene::node_t>(transformer_name) ? true : false;
+        response["views"]   = views;
+        response["outputs"] = outputs;
         return response;
     };
 
-    wf::output_t *find_output_by_name(std::string name)
+    /*
+     * Set uniforms of the filter on a view ("view-id") or output
+     * ("output-name"). Values are kept until the next frame is drawn, so
+     * any number of calls per frame cost a single upload.
+     */
+    wf::ipc::method_callback ipc_set_uniforms = [=] (wf::json_t data) -> wf::json_t
     {
-        for (auto & output : wf::get_core().output_layout->get_outputs())
+        if (!data.has_member("uniforms"))
         {
-            if (output->to_string() == name)
+            return wf::ipc::json_error("Missing uniforms");
+        }
+
+        if (data.has_member("output-name"))
+        {
+            auto output = find_output_by_name(wf::ipc::json_get_string(data, "output-name"));
+            if (!output)
             {
-                return output;
+                return wf::ipc::json_error("No such output");
             }
-        }
 
-        return nullptr;
-    }
+            return this->output_instance[output]->set_uniforms(data["uniforms"]);
+        }
 
-    wf::ipc::method_callback ipc_set_fs_shader = [=] (wf::json_t data) -> wf::json_t
-    {
-        auto output_name = wf::ipc::json_get_string(data, "output-name");
-        auto shader_path = wf::ipc::json_get_string(data, "shader-path");
+        auto view = wf::ipc::find_view_by_id(wf::ipc::json_get_uint64(data, "view-id"));
+        if (!view)
+        {
+            return wf::ipc::json_error("Failed to find view with given id.");
+        }
 
-        auto output = find_output_by_name(output_name);
-        if (!output)
+        auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+        if (!tr)
         {
-            return wf::ipc::json_error("No such output");
+            return wf::ipc::json_error("View has no shader");
         }
 
-        return this->output_instance[output]->set_fs_shader(shader_path);
+        auto error = tr->set_uniforms(data["uniforms"]);
+        return error.empty() ? wf::ipc::json_ok() : wf::ipc::json_error(error);
     };
 
-    wf::ipc::method_callback ipc_unset_fs_shader = [=] (wf::json_t data) -> wf::json_t
+    /*
+     * Cap how often the time dependent filter of a view or output is
+     * redrawn. Without "max-fps", the cap declared by its shaders applies
+     * again, 0 redraws it at the output's refresh rate.
+     */
+    wf::ipc::method_callback ipc_set_max_fps = [=] (wf::json_t data) -> wf::json_t
     {
-        auto output_name = wf::ipc::json_get_string(data, "output-name");
+        std::optional<float> max_fps;
+        if (data.has_member("max-fps"))
+        {
+            if (data["max-fps"].is_int())
+            {
+                max_fps = data["max-fps"].as_int();
+            } else if (data["max-fps"].is_double())
+            {
+                max_fps = data["max-fps"].as_double();
+            }
 
-        auto output = find_output_by_name(output_name);
-        if (!output)
+            if (!max_fps || (*max_fps < 0.0))
+            {
+                return wf::ipc::json_error("max-fps must be a number of at least 0");
+            }
+        }
+
+        std::shared_ptr<filter_chain_t> chain;
+        if (data.has_member("output-name"))
         {
-            return wf::ipc::json_error("No such output");
+            auto output = find_output_by_name(wf::ipc::json_get_string(data, "output-name"));
+            if (!output)
+            {
+                return wf::ipc::json_error("No such output");
+            }
+
+            chain = this->output_instance[output]->get_chain();
+            if (!chain)
+            {
+                return wf::ipc::json_error("Output has no shader");
+            }
+        } else
+        {
+            auto view = wf::ipc::find_view_by_id(wf::ipc::json_get_uint64(data, "view-id"));
+            if (!view)
+            {
+                return wf::ipc::json_error("Failed to find view with given id.");
+            }
+
+            auto tr = view->get_transformed_node()->get_transformer<wf_filters>(transformer_name);
+            if (!tr)
+            {
+                return wf::ipc::json_error("View has no shader");
+            }
+
+            chain = tr->chain;
         }
 
-        return this->output_instance[output]->unset_fs_shader();
+        /* Takes effect from the next frame on */
+        chain->max_fps_override = max_fps;
+        return wf::ipc::json_ok();
     };
 
-    wf::ipc::method_callback ipc_fs_has_shader = [=] (wf::json_t data) -> wf::json_t
+    /*
+     * Replace the rules set over IPC with "rules", an array of objects with
+     * a "shader-path" as for set-view-shader and any of the conditions
+     * "app-id", "title", "output", "tiled", "focused" and "fullscreen". The
+     * shaders of all rules are compiled before any of them is applied.
+     */
+    wf::ipc::method_callback ipc_set_rules = [=] (wf::json_t data) -> wf::json_t
     {
-        auto output_name = wf::ipc::json_get_string(data, "output-name");
+        if (!data.has_member("rules") || !data["rules"].is_array())
+        {
+            return wf::ipc::json_error("rules must be an array");
+        }
 
-        auto output = find_output_by_name(output_name);
-        if (!output)
+        std::vector<std::shared_ptr<filter_rule_t>> rules;
+        for (size_t i = 0; i < data["rules"].size(); i++)
         {
-            return wf::ipc::json_error("No such output");
+            auto& item = data["rules"][i];
+            if (!item.is_object() || !item.has_member("shader-path"))
+            {
+                return wf::ipc::json_error("Each rule must be an object with a shader-path");
+            }
+
+            auto rule = std::make_shared<filter_rule_t>();
+            for (auto& key : item.get_member_names())
+            {
+                if (key == "shader-path")
+                {
+                    continue;
+                }
+
+                auto& value = item[key];
+                if (!value.is_string() && !value.is_bool())
+                {
+                    return wf::ipc::json_error(key + " must be a string or boolean");
+                }
+
+                auto error = set_rule_condition(*rule, key,
+                    value.is_bool() ? (value.as_bool() ? "true" : "false") : value.as_string());
+                if (!error.empty())
+                {
+                    return wf::ipc::json_error(error);
+                }
+            }
+
+            rule->passes = get_filter_passes(item);
+            if (rule->passes.empty())
+            {
+                return wf::ipc::json_error(
+                    "shader-path must be a path, a built-in pass or a non-empty array of them");
+            }
+
+            if (!compile_rule(*rule))
+            {
+                LOGE("Failed to compile shader.");
+                return wf::ipc::json_error("Failed to compile shader.");
+            }
+
+            rules.push_back(rule);
         }
 
-        return this->output_instance[output]->fs_has_shader();
+        ipc_rules = std::move(rules);
+        reapply_rules();
+        return wf::ipc::json_ok();
     };
 
     void fini() override
     {
         per_output_tracker_mixin_t::fini_output_tracking();
 
+        on_view_mapped.disconnect();
+        on_view_set_output.disconnect();
+        on_view_tiled.disconnect();
+        on_view_fullscreen.disconnect();
+        on_view_activated.disconnect();
+        on_title_changed.disconnect();
+        on_app_id_changed.disconnect();
+        config_rules.clear();
+        ipc_rules.clear();
+
         ipc_repo->unregister_method("wf/filters/set-view-shader");
         ipc_repo->unregister_method("wf/filters/unset-view-shader");
         ipc_repo->unregister_method("wf/filters/view-has-shader");
         ipc_repo->unregister_method("wf/filters/set-fs-shader");
         ipc_repo->unregister_method("wf/filters/unset-fs-shader");
         ipc_repo->unregister_method("wf/filters/fs-has-shader");
+        ipc_repo->unregister_method("wf/filters/set-fs-scale");
+        ipc_repo->unregister_method("wf/filters/set-uniforms");
+        ipc_repo->unregister_method("wf/filters/set-max-fps");
+        ipc_repo->unregister_method("wf/filters/set-rules");
+        ipc_repo->unregister_method("wf/filters/list");
+        ipc_repo->unregister_method("wf/filters/watch");
+        ipc_repo->unregister_method("wf/filters/stats");
+        ipc_repo->unregister_method("wf/filters/memory");
+        ipc_repo->unregister_method("wf/filters/bake-lut");
+        on_client_disconnected.disconnect();
+        watcher.reset();
+        loader.reset();
+        async_requests.clear();
+        reload_tokens.clear();
 
         remove_transformers();
+        events->clients.clear();
     }
 };
 }
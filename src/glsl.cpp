@@ -0,0 +1,737 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <map>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "glsl.hpp"
+
+namespace wf
+{
+namespace scene
+{
+namespace filters
+{
+static bool is_identifier_char(char c)
+{
+    return std::isalnum((unsigned char)c) || (c == '_');
+}
+
+static std::string trim(const std::string& str)
+{
+    auto begin = str.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+
+    auto end = str.find_last_not_of(" \t\r\n");
+    return str.substr(begin, end - begin + 1);
+}
+
+/* Collapse all whitespace runs, so that declarations can be compared */
+static std::string normalize(const std::string& str)
+{
+    std::string result;
+    bool space = false;
+    for (char c : trim(str))
+    {
+        if (std::isspace((unsigned char)c))
+        {
+            space = true;
+            continue;
+        }
+
+        if (space)
+        {
+            result += ' ';
+            space = false;
+        }
+
+        result += c;
+    }
+
+    return result;
+}
+
+/* Blank out comments, keeping newlines and offsets intact */
+static std::string strip_comments(const std::string& source)
+{
+    std::string code = source;
+    size_t i = 0;
+    while (i < code.size())
+    {
+        if (code.compare(i, 2, "//") == 0)
+        {
+            while ((i < code.size()) && (code[i] != '\n'))
+            {
+                code[i++] = ' ';
+            }
+        } else if (code.compare(i, 2, "/*") == 0)
+        {
+            auto end = code.find("*/", i + 2);
+            end = (end == std::string::npos) ? code.size() : end + 2;
+            for (; i < end; i++)
+            {
+                if (code[i] != '\n')
+                {
+                    code[i] = ' ';
+                }
+            }
+        } else
+        {
+            i++;
+        }
+    }
+
+    return code;
+}
+
+/* The leading identifier of a statement, or the directive name of a preprocessor line */
+static std::string first_word(const std::string& text)
+{
+    size_t begin = (text[0] == '#') ? text.find_first_not_of(" \t", 1) : 0;
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+
+    size_t end = begin;
+    while ((end < text.size()) && is_identifier_char(text[end]))
+    {
+        end++;
+    }
+
+    return text.substr(begin, end - begin);
+}
+
+/* The name a top level declaration or function definition introduces, or "" */
+static std::string declared_name(const std::string& text)
+{
+    size_t start = 0;
+    if (first_word(text) == "layout")
+    {
+        start = text.find(')');
+        if (start == std::string::npos)
+        {
+            return "";
+        }
+    }
+
+    auto end = text.find_first_of("(=;[{", start);
+    if (end == std::string::npos)
+    {
+        return "";
+    }
+
+    while ((end > start) && std::isspace((unsigned char)text[end - 1]))
+    {
+        end--;
+    }
+
+    auto begin = end;
+    while ((begin > start) && is_identifier_char(text[begin - 1]))
+    {
+        begin--;
+    }
+
+    return text.substr(begin, end - begin);
+}
+
+/* Whether a declaration declares more than one name, e.g. float a, b; */
+static bool has_multiple_declarators(const std::string& text)
+{
+    int depth = 0;
+    for (char c : text)
+    {
+        if ((c == '(') || (c == '['))
+        {
+            depth++;
+        } else if ((c == ')') || (c == ']'))
+        {
+            depth--;
+        } else if ((c == ',') && (depth == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Split comment-free source into its top level statements: preprocessor
+ * lines, declarations and function definitions.
+ */
+static std::vector<std::string> split_top_level(const std::string& code)
+{
+    std::vector<std::string> statements;
+    size_t i = 0;
+    while ((i = code.find_first_not_of(" \t\r\n", i)) != std::string::npos)
+    {
+        size_t begin = i;
+        if ((code[i] == '#') || (code[i] == '@'))
+        {
+            /* Preprocessor directives and the @builtin@ markers span one line */
+            i = code.find('\n', i);
+            i = (i == std::string::npos) ? code.size() : i;
+        } else
+        {
+            int depth = 0;
+            for (; i < code.size(); i++)
+            {
+                if (code[i] == '{')
+                {
+                    depth++;
+                } else if ((code[i] == '}') && (--depth == 0))
+                {
+                    i++;
+                    break;
+                } else if ((code[i] == ';') && (depth == 0))
+                {
+                    i++;
+                    break;
+                }
+            }
+        }
+
+        statements.push_back(trim(code.substr(begin, i - begin)));
+    }
+
+    return statements;
+}
+
+/* The "//! key: value" declarations of a shader, in order */
+static std::vector<std::pair<std::string, std::string>> parse_declarations(const std::string& source)
+{
+    std::vector<std::pair<std::string, std::string>> declarations;
+    size_t begin = 0;
+    while (begin < source.size())
+    {
+        auto end = source.find('\n', begin);
+        end = (end == std::string::npos) ? source.size() : end;
+        auto line = trim(source.substr(begin, end - begin));
+        begin = end + 1;
+
+        auto colon = line.find(':');
+        if ((line.compare(0, 3, "//!") != 0) || (colon == std::string::npos))
+        {
+            continue;
+        }
+
+        declarations.push_back({trim(line.substr(3, colon - 3)), trim(line.substr(colon + 1))});
+    }
+
+    return declarations;
+}
+
+/* The value of a single-valued declaration, or "" */
+static std::string find_declaration(const std::string& source, const std::string& key)
+{
+    for (auto& [name, value] : parse_declarations(source))
+    {
+        if (name == key)
+        {
+            return value;
+        }
+    }
+
+    return "";
+}
+
+static std::vector<std::string> split(const std::string& str, const std::string& separators)
+{
+    std::vector<std::string> parts;
+    size_t begin = 0;
+    while ((begin = str.find_first_not_of(separators, begin)) != std::string::npos)
+    {
+        auto end = str.find_first_of(separators, begin);
+        end = (end == std::string::npos) ? str.size() : end;
+        parts.push_back(str.substr(begin, end - begin));
+        begin = end;
+    }
+
+    return parts;
+}
+
+/* Parse @count comma separated numbers, returns false if malformed */
+static bool parse_components(const std::string& str, size_t count, std::vector<float>& values)
+{
+    auto parts = split(str, ",");
+    if (parts.size() != count)
+    {
+        return false;
+    }
+
+    values.clear();
+    for (auto& part : parts)
+    {
+        char *end;
+        values.push_back(std::strtof(part.c_str(), &end));
+        if ((end == part.c_str()) || (*end != '\0'))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* "<type> <name> <default> [<min> <max>]", returns false if malformed */
+static bool parse_tunable(const std::string& declaration, glsl_tunable_t& tunable)
+{
+    static const std::map<std::string, size_t> types = {
+        {"float", 1}, {"int", 1}, {"vec2", 2}, {"vec3", 3}, {"vec4", 4},
+    };
+
+    auto words = split(declaration, " \t");
+    if (((words.size() != 3) && (words.size() != 5)) || !types.count(words[0]))
+    {
+        return false;
+    }
+
+    size_t count = types.at(words[0]);
+    tunable.type = words[0];
+    tunable.name = words[1];
+    if (!parse_components(words[2], count, tunable.value))
+    {
+        return false;
+    }
+
+    if (words.size() == 5)
+    {
+        if (!parse_components(words[3], count, tunable.min) ||
+            !parse_components(words[4], count, tunable.max))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            tunable.value[i] = std::clamp(tunable.value[i], tunable.min[i], std::max(tunable.min[i],
+                tunable.max[i]));
+        }
+    }
+
+    return true;
+}
+
+/* Whether every read of the input is a get_pixel(uvpos) call */
+static bool reads_pointwise(const std::string& code)
+{
+    for (auto token : {"gl_FragCoord", "texture(", "texture2D(", "texelFetch", "dFdx", "dFdy", "fwidth"})
+    {
+        if (code.find(token) != std::string::npos)
+        {
+            return false;
+        }
+    }
+
+    static const std::string get_pixel = "get_pixel";
+    size_t pos = 0;
+    while ((pos = code.find(get_pixel, pos)) != std::string::npos)
+    {
+        size_t end = pos + get_pixel.size();
+        bool whole_word = ((pos == 0) || !is_identifier_char(code[pos - 1])) &&
+            ((end == code.size()) || !is_identifier_char(code[end]));
+        pos = end;
+        if (!whole_word)
+        {
+            continue;
+        }
+
+        auto open = code.find_first_not_of(" \t\r\n", end);
+        if ((open == std::string::npos) || (code[open] != '('))
+        {
+            continue;
+        }
+
+        int depth    = 0;
+        size_t close = open;
+        for (; close < code.size(); close++)
+        {
+            if (code[close] == '(')
+            {
+                depth++;
+            } else if ((code[close] == ')') && (--depth == 0))
+            {
+                break;
+            }
+        }
+
+        if ((close == code.size()) || (trim(code.substr(open + 1, close - open - 1)) != "uvpos"))
+        {
+            return false;
+        }
+
+        pos = close;
+    }
+
+    return true;
+}
+
+bool glsl_is_pointwise(const std::string& source)
+{
+    auto declared = find_declaration(source, "pointwise");
+    if (declared == "false")
+    {
+        return false;
+    }
+
+    return reads_pointwise(strip_comments(source));
+}
+
+/* How often @word occurs in @code as a whole identifier */
+static size_t count_word(const std::string& code, const std::string& word)
+{
+    size_t count = 0;
+    size_t pos   = 0;
+    while ((pos = code.find(word, pos)) != std::string::npos)
+    {
+        size_t end = pos + word.size();
+        if (((pos == 0) || !is_identifier_char(code[pos - 1])) &&
+            ((end == code.size()) || !is_identifier_char(code[end])))
+        {
+            count++;
+        }
+
+        pos = end;
+    }
+
+    return count;
+}
+
+/*
+ * Whether the output only depends on the input color: the shader is
+ * pointwise without gl_FragCoord, and uvpos is only declared and passed
+ * to get_pixel(), never used as a position of its own.
+ */
+static bool reads_color_only(const std::string& code)
+{
+    if (!reads_pointwise(code) || (count_word(code, "textureSize") > 0) ||
+        (count_word(code, "margins") > 0))
+    {
+        return false;
+    }
+
+    auto statements     = split_top_level(code);
+    size_t declarations = std::count_if(statements.begin(), statements.end(),
+        [] (const std::string& statement) { return declared_name(statement) == "uvpos"; });
+    return count_word(code, "uvpos") == declarations + count_word(code, "get_pixel");
+}
+
+/* Whether the source declares a uniform called @name */
+static bool declares_uniform(const std::string& source, const std::string& name)
+{
+    auto statements = split_top_level(strip_comments(source));
+    return std::any_of(statements.begin(), statements.end(), [&] (const std::string& statement)
+    {
+        return (first_word(statement) == "uniform") && (declared_name(statement) == name);
+    });
+}
+
+glsl_metadata_t glsl_parse_metadata(const std::string& source)
+{
+    glsl_metadata_t metadata;
+    metadata.pointwise       = glsl_is_pointwise(source);
+    metadata.color_only      = reads_color_only(strip_comments(source));
+    metadata.sampling_radius = metadata.pointwise ? 0.0 : -1.0;
+    metadata.time_dependent  = declares_uniform(source, "time");
+    metadata.max_fps = 0.0;
+    metadata.needs_margins   = strip_comments(source).find("margins") != std::string::npos;
+
+    for (auto& [key, value] : parse_declarations(source))
+    {
+        if (key == "sampling-radius")
+        {
+            char *end;
+            float radius = std::strtof(value.c_str(), &end);
+            if ((end != value.c_str()) && (*end == '\0'))
+            {
+                metadata.sampling_radius = std::max(0.0f, radius);
+            } else
+            {
+                metadata.sampling_radius_uniform = value;
+            }
+        } else if ((key == "color-only") && ((value == "true") || (value == "false")))
+        {
+            metadata.color_only = (value == "true");
+        } else if ((key == "time-dependent") && ((value == "true") || (value == "false")))
+        {
+            metadata.time_dependent = (value == "true");
+        } else if (key == "max-fps")
+        {
+            char *end;
+            float fps = std::strtof(value.c_str(), &end);
+            if ((end != value.c_str()) && (*end == '\0') && (fps > 0.0))
+            {
+                metadata.max_fps = fps;
+            }
+        } else if ((key == "needs-margins") && ((value == "true") || (value == "false")))
+        {
+            metadata.needs_margins = (value == "true");
+        } else if (key == "edge-band")
+        {
+            metadata.edge_band = split(value, " \t");
+        } else if ((key == "tunable") || (key == "constant"))
+        {
+            glsl_tunable_t tunable;
+            if (parse_tunable(value, tunable))
+            {
+                tunable.constant = (key == "constant");
+                metadata.tunables.push_back(tunable);
+            }
+        }
+    }
+
+    /* Every term must be a number or a float tunable, or the band is unknown */
+    for (auto& term : metadata.edge_band)
+    {
+        char *end;
+        std::strtof(term.c_str(), &end);
+        bool number  = (end != term.c_str()) && (*end == '\0');
+        bool tunable = std::any_of(metadata.tunables.begin(), metadata.tunables.end(),
+            [&] (const glsl_tunable_t& t) { return (t.name == term) && (t.type == "float"); });
+        if (!number && !tunable)
+        {
+            metadata.edge_band.clear();
+            break;
+        }
+    }
+
+    if (!metadata.sampling_radius_uniform.empty())
+    {
+        auto it = std::find_if(metadata.tunables.begin(), metadata.tunables.end(),
+            [&] (const glsl_tunable_t& t) { return t.name == metadata.sampling_radius_uniform; });
+        if ((it == metadata.tunables.end()) || (it->type != "float"))
+        {
+            metadata.sampling_radius_uniform.clear();
+        } else
+        {
+            metadata.sampling_radius = std::abs(it->value[0]);
+        }
+    }
+
+    return metadata;
+}
+
+/*
+ * Whether @source declares a tunable or constant of the same name as one
+ * of @sources. Fused passes would share its value and default.
+ */
+static bool shares_tunables(const std::vector<std::string>& sources, const std::string& source)
+{
+    auto tunables = glsl_parse_metadata(source).tunables;
+    return std::any_of(sources.begin(), sources.end(), [&] (const std::string& other)
+    {
+        auto other_tunables = glsl_parse_metadata(other).tunables;
+        return std::any_of(other_tunables.begin(), other_tunables.end(), [&] (const glsl_tunable_t& a)
+        {
+            return std::any_of(tunables.begin(), tunables.end(),
+                [&] (const glsl_tunable_t& b) { return a.name == b.name; });
+        });
+    });
+}
+
+std::string glsl_fuse_passes(const std::vector<std::string>& sources)
+{
+    /* Inputs and outputs are shared by all passes and declared once */
+    std::map<std::string, std::string> interface;
+    std::string interface_decls, passes, calls;
+
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        if ((i > 0) && (!glsl_is_pointwise(sources[i]) ||
+                        shares_tunables({sources.begin(), sources.begin() + i}, sources[i])))
+        {
+            return "";
+        }
+
+        std::string prefix = "_filter_pass" + std::to_string(i) + "_";
+        std::string defines, body, undefs;
+        std::map<std::string, bool> renamed;
+        for (auto& statement : split_top_level(strip_comments(sources[i])))
+        {
+            auto word = first_word(statement);
+            if ((statement[0] == '@') || ((statement[0] == '#') && (word == "version")) ||
+                (word == "precision"))
+            {
+                continue;
+            }
+
+            if (statement[0] == '#')
+            {
+                body += statement + "\n";
+                continue;
+            }
+
+            auto name = declared_name(statement);
+            if ((word == "uniform") || (word == "in") || (word == "out"))
+            {
+                auto it = interface.find(name);
+                if (it == interface.end())
+                {
+                    interface[name] = normalize(statement);
+                    interface_decls += statement + "\n";
+                } else if (it->second != normalize(statement))
+                {
+                    return "";
+                }
+
+                continue;
+            }
+
+            if ((statement.back() != '}') && has_multiple_declarators(statement))
+            {
+                return "";
+            }
+
+            /* Give every other global, main() included, a name private to this pass */
+            if (!name.empty() && !renamed[name])
+            {
+                renamed[name] = true;
+                defines += "#define " + name + " " + prefix + name + "\n";
+                undefs  += "#undef " + name + "\n";
+            }
+
+            body += statement + "\n";
+        }
+
+        if (!renamed["main"])
+        {
+            return "";
+        }
+
+        if (i > 0)
+        {
+            defines += "#define get_pixel(uv) _filter_color\n";
+            undefs  += "#undef get_pixel\n";
+        }
+
+        passes += defines + "#define out_color _filter_color\n" + body + undefs + "#undef out_color\n\n";
+        calls  += "    " + prefix + "main();\n";
+    }
+
+    if (!interface.count("out_color"))
+    {
+        return "";
+    }
+
+    return "#version 300 es\n@builtin_ext@\n@builtin@\n\nprecision mediump float;\n\n" +
+           interface_decls + "\nvec4 _filter_color;\n\n" + passes +
+           "void main()\n{\n" + calls + "    out_color = _filter_color;\n}\n";
+}
+
+std::vector<glsl_stage_t> glsl_plan_chain(const std::vector<std::string>& sources)
+{
+    std::vector<glsl_stage_t> stages;
+    for (auto& source : sources)
+    {
+        if (stages.empty() || !glsl_is_pointwise(source) || shares_tunables(stages.back().passes, source))
+        {
+            stages.push_back({source, {source}});
+        } else
+        {
+            stages.back().passes.push_back(source);
+        }
+    }
+
+    for (auto& stage : stages)
+    {
+        if (stage.passes.size() > 1)
+        {
+            stage.source = glsl_fuse_passes(stage.passes);
+        }
+    }
+
+    return stages;
+}
+
+/* A GLSL literal, floats always have a decimal point */
+static std::string format_constant(const glsl_tunable_t& constant)
+{
+    auto format = [&] (float value)
+    {
+        char buf[32];
+        if (constant.type == "int")
+        {
+            snprintf(buf, sizeof(buf), "%d", (int)value);
+            return std::string(buf);
+        }
+
+        snprintf(buf, sizeof(buf), "%.9g", value);
+        std::string literal = buf;
+        if (literal.find_first_of(".e") == std::string::npos)
+        {
+            literal += ".0";
+        }
+
+        return literal;
+    };
+
+    if (constant.value.size() == 1)
+    {
+        return format(constant.value[0]);
+    }
+
+    std::string literal = constant.type + "(";
+    for (size_t i = 0; i < constant.value.size(); i++)
+    {
+        literal += (i ? ", " : "") + format(constant.value[i]);
+    }
+
+    return literal + ")";
+}
+
+std::string glsl_specialize(const std::string& source, const std::vector<glsl_tunable_t>& constants)
+{
+    std::string defines;
+    for (auto& constant : constants)
+    {
+        if (constant.constant)
+        {
+            defines += "#define " + constant.name + " " + format_constant(constant) + "\n";
+        }
+    }
+
+    auto version = source.find("#version");
+    if (defines.empty() || (version == std::string::npos))
+    {
+        return source;
+    }
+
+    auto line_end = source.find('\n', version);
+    if (line_end == std::string::npos)
+    {
+        return source + "\n" + defines;
+    }
+
+    return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+}
+}
+}
+}
@@ -0,0 +1,144 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+ * Source level helpers for the filter fragment shaders. These only look at
+ * the GLSL text and do not need a GL context.
+ */
+namespace wf
+{
+namespace scene
+{
+namespace filters
+{
+/*
+ * Whether the shader only ever samples its input at the current position,
+ * i.e. every get_pixel() call reads uvpos and no other texture access or
+ * gl_FragCoord is used. Pointwise shaders are fused into the pass before
+ * them and have a sampling radius of 0. The output may still depend on
+ * uvpos, but not on gl_FragCoord, which changes with the scale a filter
+ * runs at. Declaring "pointwise: false" opts out, "pointwise: true" does
+ * not override what the source shows.
+ */
+bool glsl_is_pointwise(const std::string& source);
+
+/* A uniform which the shader lets users tune */
+struct glsl_tunable_t
+{
+    std::string name;
+    /* float, int, vec2, vec3 or vec4 */
+    std::string type;
+    std::vector<float> value;
+    /* Empty if unbounded */
+    std::vector<float> min, max;
+    /* Compiled in as a #define instead of a uniform, see glsl_specialize() */
+    bool constant = false;
+};
+
+/*
+ * What a shader declares about itself in "//! key: value" comment lines,
+ * conventionally right after #version:
+ *
+ *   //! sampling-radius: 8
+ *   //! pointwise: true
+ *   //! color-only: true
+ *   //! time-dependent: true
+ *   //! max-fps: 30
+ *   //! needs-margins: false
+ *   //! tunable: float radius 8.0 0.0 64.0
+ *   //! constant: float quality 3.0 1.0 16.0
+ *   //! edge-band: corner_radius border_size
+ *
+ * The sampling radius is how far from uvpos the input is read, in pixels,
+ * or the name of a float tunable holding that distance. A tunable is a
+ * uniform with its type, default value and optional range, vector values
+ * have comma separated components. A constant is declared like a tunable,
+ * but is not a uniform and must not be declared by the shader. A shader
+ * is color only if its output depends on nothing but the input color at
+ * uvpos, not on the position or size, so that it can be baked into a LUT.
+ * Shaders declaring a time uniform are time dependent, and redrawn at most
+ * max-fps times a second if given. Anything undeclared is guessed from the
+ * source, falling back to the worst case.
+ */
+struct glsl_metadata_t
+{
+    /* Negative if unknown */
+    float sampling_radius;
+    /* The tunable the sampling radius follows, if any */
+    std::string sampling_radius_uniform;
+    bool pointwise;
+    bool color_only;
+    bool time_dependent;
+    /* How often a time dependent shader is redrawn at most, 0 if not limited */
+    float max_fps;
+    bool needs_margins;
+    std::vector<glsl_tunable_t> tunables;
+    /*
+     * The shader leaves its input unchanged further inside than this from
+     * the window geometry, or from the texture edges if it does not need
+     * margins. The width is the largest of the terms, each a number or the
+     * name of a float tunable. Empty if any pixel may change.
+     */
+    std::vector<std::string> edge_band;
+};
+
+glsl_metadata_t glsl_parse_metadata(const std::string& source);
+
+/*
+ * Define each of @constants at its current value right after #version,
+ * so that the compiler can unroll and fold the code using them. Tunables
+ * which are not constants are ignored.
+ */
+std::string glsl_specialize(const std::string& source, const std::vector<glsl_tunable_t>& constants);
+
+/*
+ * Fuse consecutive passes into one program. The first pass samples the
+ * input texture as usual, every following pass must be pointwise and reads
+ * the color written by the pass before it instead. Returns an empty string
+ * if the sources cannot be combined, also if two of them declare tunables
+ * of the same name.
+ */
+std::string glsl_fuse_passes(const std::vector<std::string>& sources);
+
+/* One program of a filter chain, made of one or more fused passes */
+struct glsl_stage_t
+{
+    std::string source;
+    std::vector<std::string> passes;
+};
+
+/*
+ * Split a chain of passes into the programs that actually run, fusing
+ * every pointwise pass into the pass before it, unless their tunables
+ * clash.
+ */
+std::vector<glsl_stage_t> glsl_plan_chain(const std::vector<std::string>& sources);
+}
+}
+}
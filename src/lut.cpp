@@ -0,0 +1,247 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+#include "lut.hpp"
+
+namespace wf
+{
+namespace scene
+{
+namespace filters
+{
+/* The .cube specification allows at most 256 entries per axis */
+static constexpr int max_lut_size = 256;
+
+lut_t lut_identity(int size)
+{
+    lut_t lut;
+    lut.size = size;
+    lut.data.reserve(3 * size * size * size);
+    for (int b = 0; b < size; b++)
+    {
+        for (int g = 0; g < size; g++)
+        {
+            for (int r = 0; r < size; r++)
+            {
+                lut.data.push_back(r / (size - 1.0f));
+                lut.data.push_back(g / (size - 1.0f));
+                lut.data.push_back(b / (size - 1.0f));
+            }
+        }
+    }
+
+    return lut;
+}
+
+/* Parse exactly three numbers from @line, returns false if malformed */
+static bool parse_triple(const std::string& line, float out[3])
+{
+    const char *pos = line.c_str();
+    for (int i = 0; i < 3; i++)
+    {
+        char *end;
+        out[i] = std::strtof(pos, &end);
+        if (end == pos)
+        {
+            return false;
+        }
+
+        pos = end;
+    }
+
+    while (std::isspace((unsigned char)*pos))
+    {
+        pos++;
+    }
+
+    return *pos == '\0';
+}
+
+std::optional<lut_t> lut_parse_cube(const std::string& text, std::string& error)
+{
+    lut_t lut;
+    std::istringstream stream(text);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(stream, line))
+    {
+        line_number++;
+        auto begin = line.find_first_not_of(" \t\r");
+        if ((begin == std::string::npos) || (line[begin] == '#'))
+        {
+            continue;
+        }
+
+        line = line.substr(begin);
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        auto where = " on line " + std::to_string(line_number);
+        if (std::isalpha((unsigned char)line[0]))
+        {
+            auto space   = line.find_first_of(" \t");
+            auto keyword = line.substr(0, space);
+            auto value   = (space == std::string::npos) ? "" : line.substr(space + 1);
+            if (keyword == "TITLE")
+            {
+                continue;
+            } else if (keyword == "LUT_3D_SIZE")
+            {
+                lut.size = std::atoi(value.c_str());
+                if ((lut.size < 2) || (lut.size > max_lut_size))
+                {
+                    error = "Invalid LUT_3D_SIZE" + where;
+                    return {};
+                }
+            } else if (keyword == "DOMAIN_MIN")
+            {
+                if (!parse_triple(value, lut.domain_min))
+                {
+                    error = "Invalid DOMAIN_MIN" + where;
+                    return {};
+                }
+            } else if (keyword == "DOMAIN_MAX")
+            {
+                if (!parse_triple(value, lut.domain_max))
+                {
+                    error = "Invalid DOMAIN_MAX" + where;
+                    return {};
+                }
+            } else if (keyword == "LUT_1D_SIZE")
+            {
+                error = "1D LUTs are not supported";
+                return {};
+            } else
+            {
+                error = "Unknown keyword " + keyword + where;
+                return {};
+            }
+
+            continue;
+        }
+
+        float rgb[3];
+        if ((lut.size == 0) || !parse_triple(line, rgb))
+        {
+            error = "Invalid table entry" + where;
+            return {};
+        }
+
+        lut.data.insert(lut.data.end(), rgb, rgb + 3);
+    }
+
+    if (lut.size == 0)
+    {
+        error = "Missing LUT_3D_SIZE";
+        return {};
+    }
+
+    if (lut.data.size() != 3 * (size_t)lut.size * lut.size * lut.size)
+    {
+        error = "Expected " + std::to_string(lut.size * lut.size * lut.size) + " table entries, found " +
+            std::to_string(lut.data.size() / 3);
+        return {};
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (lut.domain_max[i] <= lut.domain_min[i])
+        {
+            error = "Empty domain";
+            return {};
+        }
+    }
+
+    return lut;
+}
+
+std::string lut_to_cube(const lut_t& lut, const std::string& title)
+{
+    std::ostringstream out;
+    char line[96];
+    out << "TITLE \"" << title << "\"\n";
+    out << "LUT_3D_SIZE " << lut.size << "\n";
+    snprintf(line, sizeof(line), "DOMAIN_MIN %.6f %.6f %.6f\nDOMAIN_MAX %.6f %.6f %.6f\n",
+        lut.domain_min[0], lut.domain_min[1], lut.domain_min[2],
+        lut.domain_max[0], lut.domain_max[1], lut.domain_max[2]);
+    out << line;
+    for (size_t i = 0; i + 2 < lut.data.size(); i += 3)
+    {
+        snprintf(line, sizeof(line), "%.6f %.6f %.6f\n", lut.data[i], lut.data[i + 1], lut.data[i + 2]);
+        out << line;
+    }
+
+    return out.str();
+}
+
+void lut_sample(const lut_t& lut, const float rgb[3], float out[3])
+{
+    int base[3];
+    float frac[3];
+    for (int i = 0; i < 3; i++)
+    {
+        float t = (rgb[i] - lut.domain_min[i]) / (lut.domain_max[i] - lut.domain_min[i]);
+        t = std::clamp(t, 0.0f, 1.0f) * (lut.size - 1);
+        base[i] = std::min((int)t, lut.size - 2);
+        frac[i] = t - base[i];
+    }
+
+    out[0] = out[1] = out[2] = 0.0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        float weight = 1.0;
+        size_t index = 0;
+        size_t stride = 1;
+        for (int i = 0; i < 3; i++)
+        {
+            int bit = (corner >> i) & 1;
+            weight *= bit ? frac[i] : 1.0 - frac[i];
+            index  += (base[i] + bit) * stride;
+            stride *= lut.size;
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            out[c] += weight * lut.data[3 * index + c];
+        }
+    }
+}
+
+lut_t lut_compose(const lut_t& first, const lut_t& second)
+{
+    lut_t result = first;
+    for (size_t i = 0; i + 2 < result.data.size(); i += 3)
+    {
+        lut_sample(second, &first.data[i], &result.data[i]);
+    }
+
+    return result;
+}
+}
+}
+}
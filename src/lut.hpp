@@ -0,0 +1,75 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+
+/*
+ * 3D color lookup tables for the LUT passes. These only deal with the
+ * table data and do not need a GL context.
+ */
+namespace wf
+{
+namespace scene
+{
+namespace filters
+{
+/* A 3D LUT as described by an Adobe/Resolve .cube file */
+struct lut_t
+{
+    /* Entries per axis */
+    int size = 0;
+    /* The input range mapped onto the table */
+    float domain_min[3] = {0.0, 0.0, 0.0};
+    float domain_max[3] = {1.0, 1.0, 1.0};
+    /* size^3 RGB entries, red changing fastest, then green, then blue */
+    std::vector<float> data;
+};
+
+/* An identity table of @size entries per axis */
+lut_t lut_identity(int size);
+
+/*
+ * Parse the text of a .cube file. Only 3D tables are supported. Returns
+ * nothing and sets @error if the file is malformed.
+ */
+std::optional<lut_t> lut_parse_cube(const std::string& text, std::string& error);
+
+/* The text of a .cube file holding @lut */
+std::string lut_to_cube(const lut_t& lut, const std::string& title);
+
+/* Look up @rgb in @lut with trilinear interpolation, clamping to the domain */
+void lut_sample(const lut_t& lut, const float rgb[3], float out[3]);
+
+/*
+ * A single table applying @first, then @second, at the size and domain
+ * of @first.
+ */
+lut_t lut_compose(const lut_t& first, const lut_t& second);
+}
+}
+}
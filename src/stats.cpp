@@ -0,0 +1,208 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+#include <wayfire/opengl.hpp>
+#include "stats.hpp"
+
+namespace wf
+{
+namespace scene
+{
+namespace filters
+{
+static bool timer_queries_supported()
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        auto extensions = (const char*)glGetString(GL_EXTENSIONS);
+        supported = extensions && std::strstr(extensions, "GL_EXT_disjoint_timer_query");
+    }
+
+    return supported;
+}
+
+/* Store @value in the ring @samples of at most @size entries */
+template<class T>
+static void push_sample(std::vector<T>& samples, size_t& next, size_t size, const T& value)
+{
+    if (samples.size() < size)
+    {
+        samples.push_back(value);
+    } else
+    {
+        samples[next] = value;
+    }
+
+    next = (next + 1) % size;
+}
+
+static wf::json_t summarize(std::vector<double> samples)
+{
+    wf::json_t summary;
+    if (samples.empty())
+    {
+        return summary;
+    }
+
+    double sum = 0.0;
+    for (auto sample : samples)
+    {
+        sum += sample;
+    }
+
+    size_t p99 = (samples.size() * 99 + 99) / 100 - 1;
+    std::nth_element(samples.begin(), samples.begin() + p99, samples.end());
+    summary["avg"] = sum / samples.size();
+    summary["p99"] = samples[p99];
+    return summary;
+}
+
+filter_stats_t::~filter_stats_t()
+{
+    if (queries[0])
+    {
+        wf::gles::run_in_context([&]
+        {
+            GL_CALL(glDeleteQueries(num_queries, queries));
+        });
+    }
+}
+
+void filter_stats_t::begin_frame()
+{
+    collect_queries();
+    frame_start = std::chrono::steady_clock::now();
+    current     = {};
+
+    /* Skip timing this frame if every query is still in flight */
+    if (!timer_queries_supported() || (pending_queries == num_queries))
+    {
+        return;
+    }
+
+    if (!queries[0])
+    {
+        GL_CALL(glGenQueries(num_queries, queries));
+    }
+
+    GL_CALL(glBeginQuery(GL_TIME_ELAPSED_EXT, queries[(first_query + pending_queries) % num_queries]));
+    query_running = true;
+}
+
+void filter_stats_t::count_bind()
+{
+    current.binds++;
+}
+
+void filter_stats_t::count_draw(bool scissored)
+{
+    GLint box[4];
+    GL_CALL(glGetIntegerv(GL_VIEWPORT, box));
+    int x1 = box[0], y1 = box[1], x2 = box[0] + box[2], y2 = box[1] + box[3];
+    if (scissored)
+    {
+        GL_CALL(glGetIntegerv(GL_SCISSOR_BOX, box));
+        x1 = std::max(x1, box[0]);
+        y1 = std::max(y1, box[1]);
+        x2 = std::min(x2, box[0] + box[2]);
+        y2 = std::min(y2, box[1] + box[3]);
+    }
+
+    if ((x2 > x1) && (y2 > y1))
+    {
+        current.pixels += uint64_t(x2 - x1) * (y2 - y1);
+    }
+
+    current.rects++;
+}
+
+void filter_stats_t::end_frame()
+{
+    if (query_running)
+    {
+        GL_CALL(glEndQuery(GL_TIME_ELAPSED_EXT));
+        pending_queries++;
+        query_running = false;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - frame_start;
+    current.cpu_ms = elapsed.count();
+    push_sample(frames, next_frame, num_frames, current);
+}
+
+void filter_stats_t::collect_queries()
+{
+    /* Results are meaningless across a disjoint event, such as a GPU reset */
+    GLint disjoint = 0;
+    GL_CALL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+
+    while (pending_queries > 0)
+    {
+        GLuint available = 0;
+        GL_CALL(glGetQueryObjectuiv(queries[first_query], GL_QUERY_RESULT_AVAILABLE, &available));
+        if (!available)
+        {
+            break;
+        }
+
+        GLuint elapsed_ns = 0;
+        GL_CALL(glGetQueryObjectuiv(queries[first_query], GL_QUERY_RESULT, &elapsed_ns));
+        if (!disjoint)
+        {
+            push_sample(gpu_ms, next_gpu_ms, num_frames, elapsed_ns / 1e6);
+        }
+
+        first_query = (first_query + 1) % num_queries;
+        pending_queries--;
+    }
+}
+
+wf::json_t filter_stats_t::to_json() const
+{
+    std::vector<double> cpu, pixels, rects, binds;
+    for (auto& frame : frames)
+    {
+        cpu.push_back(frame.cpu_ms);
+        pixels.push_back(frame.pixels);
+        rects.push_back(frame.rects);
+        binds.push_back(frame.binds);
+    }
+
+    wf::json_t stats;
+    stats["frames"] = (uint64_t)frames.size();
+    stats["cpu-ms"] = summarize(cpu);
+    stats["gpu-ms"] = summarize(gpu_ms);
+    stats["pixels"] = summarize(pixels);
+    stats["rects"]  = summarize(rects);
+    stats["binds"]  = summarize(binds);
+    return stats;
+}
+}
+}
+}
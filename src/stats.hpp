@@ -0,0 +1,96 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 Scott Moreau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <GLES3/gl3.h>
+#include <wayfire/nonstd/json.hpp>
+
+/*
+ * Frame cost instrumentation for filters, enabled with filters/stats and
+ * read with wf/filters/stats.
+ */
+namespace wf
+{
+namespace scene
+{
+namespace filters
+{
+/*
+ * The cost of one view or output filter over its last frames. GPU time is
+ * measured with GL_EXT_disjoint_timer_query. The queries are kept in a
+ * small ring and read back a few frames later, so the CPU never waits for
+ * the GPU. All methods must be called in the renderer's GL context.
+ */
+class filter_stats_t
+{
+  public:
+    ~filter_stats_t();
+
+    /* Start measuring a frame of the filter */
+    void begin_frame();
+    /* Count a program bind */
+    void count_bind();
+    /* Count a draw call, over the scissor box if @scissored */
+    void count_draw(bool scissored);
+    void end_frame();
+
+    /* Averages and 99th percentiles over the last frames */
+    wf::json_t to_json() const;
+
+  private:
+    struct frame_t
+    {
+        double cpu_ms = 0.0;
+        uint64_t pixels = 0;
+        uint64_t rects  = 0;
+        uint64_t binds  = 0;
+    };
+
+    static constexpr int num_queries  = 4;
+    static constexpr size_t num_frames = 128;
+
+    GLuint queries[num_queries] = {0};
+    /* The oldest query not read yet, and how many are in flight */
+    int first_query = 0;
+    int pending_queries = 0;
+    bool query_running  = false;
+
+    std::chrono::steady_clock::time_point frame_start;
+    frame_t current;
+    /* Rings of the last num_frames samples */
+    std::vector<frame_t> frames;
+    size_t next_frame = 0;
+    std::vector<double> gpu_ms;
+    size_t next_gpu_ms = 0;
+
+    /* Read back the queries which have finished, without waiting */
+    void collect_queries();
+};
+}
+}
+}